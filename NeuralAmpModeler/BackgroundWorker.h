@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace dsp
+{
+// A single thread that runs jobs one at a time, in the order that they were submitted.
+// Use it for work that mustn't happen on the audio thread (reading files, prewarming models, building kernels...).
+// Jobs hand their results back to the audio thread themselves (e.g. through the plugin's staging area).
+// Don't submit from the audio thread: submitting takes a lock and may allocate.
+class BackgroundWorker
+{
+public:
+  BackgroundWorker() { mThread = std::thread([this]() { _Run(); }); };
+  ~BackgroundWorker() { Stop(); };
+
+  BackgroundWorker(const BackgroundWorker&) = delete;
+  BackgroundWorker& operator=(const BackgroundWorker&) = delete;
+
+  void Submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mStopping)
+        return;
+      mJobs.push_back(std::move(job));
+    }
+    mCondition.notify_one();
+  };
+
+  // Block until every job submitted so far has finished.
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdleCondition.wait(lock, [this]() { return mJobs.empty() && !mBusy; });
+  };
+
+  // Finish the job that's running (if any), drop the rest, and join the thread.
+  void Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+      mJobs.clear();
+    }
+    mCondition.notify_one();
+    if (mThread.joinable())
+      mThread.join();
+  };
+
+private:
+  void _Run()
+  {
+    while (true)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+        if (mStopping)
+          break;
+        job = std::move(mJobs.front());
+        mJobs.pop_front();
+        mBusy = true;
+      }
+      try
+      {
+        job();
+      }
+      catch (std::exception& e)
+      {
+        std::cerr << "Caught unhandled exception in background job:" << std::endl;
+        std::cerr << e.what() << std::endl;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBusy = false;
+      }
+      mIdleCondition.notify_all();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mBusy = false;
+    }
+    mIdleCondition.notify_all();
+  };
+
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::condition_variable mIdleCondition;
+  std::deque<std::function<void()>> mJobs;
+  bool mBusy = false;
+  bool mStopping = false;
+  std::thread mThread;
+};
+}; // namespace dsp
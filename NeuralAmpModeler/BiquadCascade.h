@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "architecture.hpp"
+
+#ifdef ARCH_EXT_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace dsp
+{
+namespace biquad
+{
+// Normalized so that a0 = 1
+struct Coefficients
+{
+  double b0 = 1.0;
+  double b1 = 0.0;
+  double b2 = 0.0;
+  double a1 = 0.0;
+  double a2 = 0.0;
+};
+
+inline Coefficients Normalize(const double a0, const double a1, const double a2, const double b0, const double b1,
+                              const double b2)
+{
+  Coefficients c;
+  c.b0 = b0 / a0;
+  c.b1 = b1 / a0;
+  c.b2 = b2 / a0;
+  c.a1 = a1 / a0;
+  c.a2 = a2 / a0;
+  return c;
+};
+
+// The filters from the Audio EQ Cookbook (R. Bristow-Johnson), as recursive_linear_filter designs them
+struct CookbookTerms
+{
+  CookbookTerms(const double sampleRate, const double frequency, const double quality, const double gainDB)
+  {
+    a = std::pow(10.0, gainDB / 40.0);
+    const double omega0 = 2.0 * M_PI * frequency / sampleRate;
+    alpha = std::sin(omega0) / (2.0 * quality);
+    cosw = std::cos(omega0);
+  };
+  double a;
+  double alpha;
+  double cosw;
+};
+
+inline Coefficients LowShelf(const double sampleRate, const double frequency, const double quality,
+                             const double gainDB)
+{
+  const CookbookTerms t(sampleRate, frequency, quality, gainDB);
+  const double ap = t.a + 1.0;
+  const double am = t.a - 1.0;
+  const double roota2alpha = 2.0 * std::sqrt(t.a) * t.alpha;
+  return Normalize(ap + am * t.cosw + roota2alpha, -2.0 * (am + ap * t.cosw), ap + am * t.cosw - roota2alpha,
+                   t.a * (ap - am * t.cosw + roota2alpha), 2.0 * t.a * (am - ap * t.cosw),
+                   t.a * (ap - am * t.cosw - roota2alpha));
+};
+
+inline Coefficients Peaking(const double sampleRate, const double frequency, const double quality,
+                            const double gainDB)
+{
+  const CookbookTerms t(sampleRate, frequency, quality, gainDB);
+  return Normalize(1.0 + t.alpha / t.a, -2.0 * t.cosw, 1.0 - t.alpha / t.a, 1.0 + t.alpha * t.a, -2.0 * t.cosw,
+                   1.0 - t.alpha * t.a);
+};
+
+inline Coefficients HighShelf(const double sampleRate, const double frequency, const double quality,
+                              const double gainDB)
+{
+  const CookbookTerms t(sampleRate, frequency, quality, gainDB);
+  const double ap = t.a + 1.0;
+  const double am = t.a - 1.0;
+  const double roota2alpha = 2.0 * std::sqrt(t.a) * t.alpha;
+  return Normalize(ap - am * t.cosw + roota2alpha, 2.0 * (am - ap * t.cosw), ap - am * t.cosw - roota2alpha,
+                   t.a * (ap + am * t.cosw + roota2alpha), -2.0 * t.a * (am + ap * t.cosw),
+                   t.a * (ap + am * t.cosw - roota2alpha));
+};
+
+// NumSections biquads in series, run over the whole block in one pass (transposed direct form II) instead of one
+// pass per filter. Channels go in pairs, one per SIMD lane, so a stereo block is one pass for everything. The same
+// coefficients are used for every channel.
+template <size_t NumSections>
+class Cascade
+{
+public:
+  Cascade() { SetNumChannels(2); };
+
+  // Allocates if there are more channels than there have been.
+  void SetNumChannels(const size_t numChannels)
+  {
+    const size_t numPairs = (numChannels + 1) / 2;
+    if (mState.size() < numPairs)
+      mState.resize(numPairs);
+  };
+
+  void SetCoefficients(const size_t section, const Coefficients& c)
+  {
+    Section& s = mSections[section];
+    for (size_t lane = 0; lane < 2; lane++)
+    {
+      s.b0[lane] = c.b0;
+      s.b1[lane] = c.b1;
+      s.b2[lane] = c.b2;
+      s.a1[lane] = c.a1;
+      s.a2[lane] = c.a2;
+    }
+  };
+
+  // Back to rest
+  void Reset()
+  {
+    for (auto& pair : mState)
+      pair = PairState();
+  };
+
+  // In place is fine. Doesn't allocate as long as SetNumChannels() was told about this many channels.
+  void Process(const double* const* inputs, double* const* outputs, const size_t numChannels, const size_t numFrames)
+  {
+    SetNumChannels(numChannels);
+    for (size_t c = 0; c < numChannels; c += 2)
+    {
+      if (c + 1 < numChannels)
+        _ProcessPair(inputs[c], inputs[c + 1], outputs[c], outputs[c + 1], mState[c / 2], numFrames);
+      else
+        _ProcessLane(inputs[c], outputs[c], mState[c / 2], 0, numFrames);
+    }
+  };
+
+private:
+  // Each coefficient once per lane so that it loads straight into a register
+  struct alignas(16) Section
+  {
+    double b0[2] = {1.0, 1.0};
+    double b1[2] = {0.0, 0.0};
+    double b2[2] = {0.0, 0.0};
+    double a1[2] = {0.0, 0.0};
+    double a2[2] = {0.0, 0.0};
+  };
+  struct alignas(16) PairState
+  {
+    // [section][lane]
+    double s1[NumSections][2] = {};
+    double s2[NumSections][2] = {};
+  };
+
+  void _ProcessPair(const double* inputL, const double* inputR, double* outputL, double* outputR, PairState& state,
+                    const size_t numFrames)
+  {
+#ifdef ARCH_EXT_SSE2
+    __m128d b0[NumSections], b1[NumSections], b2[NumSections], a1[NumSections], a2[NumSections];
+    __m128d s1[NumSections], s2[NumSections];
+    for (size_t k = 0; k < NumSections; k++)
+    {
+      b0[k] = _mm_load_pd(mSections[k].b0);
+      b1[k] = _mm_load_pd(mSections[k].b1);
+      b2[k] = _mm_load_pd(mSections[k].b2);
+      a1[k] = _mm_load_pd(mSections[k].a1);
+      a2[k] = _mm_load_pd(mSections[k].a2);
+      s1[k] = _mm_load_pd(state.s1[k]);
+      s2[k] = _mm_load_pd(state.s2[k]);
+    }
+    for (size_t i = 0; i < numFrames; i++)
+    {
+      __m128d x = _mm_set_pd(inputR[i], inputL[i]);
+      for (size_t k = 0; k < NumSections; k++)
+      {
+        const __m128d y = _mm_add_pd(_mm_mul_pd(b0[k], x), s1[k]);
+        s1[k] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[k], x), _mm_mul_pd(a1[k], y)), s2[k]);
+        s2[k] = _mm_sub_pd(_mm_mul_pd(b2[k], x), _mm_mul_pd(a2[k], y));
+        x = y;
+      }
+      _mm_storel_pd(outputL + i, x);
+      _mm_storeh_pd(outputR + i, x);
+    }
+    for (size_t k = 0; k < NumSections; k++)
+    {
+      _mm_store_pd(state.s1[k], s1[k]);
+      _mm_store_pd(state.s2[k], s2[k]);
+    }
+#else
+    _ProcessLane(inputL, outputL, state, 0, numFrames);
+    _ProcessLane(inputR, outputR, state, 1, numFrames);
+#endif
+  };
+
+  void _ProcessLane(const double* input, double* output, PairState& state, const size_t lane, const size_t numFrames)
+  {
+    for (size_t i = 0; i < numFrames; i++)
+    {
+      double x = input[i];
+      for (size_t k = 0; k < NumSections; k++)
+      {
+        const Section& s = mSections[k];
+        const double y = s.b0[lane] * x + state.s1[k][lane];
+        state.s1[k][lane] = s.b1[lane] * x - s.a1[lane] * y + state.s2[k][lane];
+        state.s2[k][lane] = s.b2[lane] * x - s.a2[lane] * y;
+        x = y;
+      }
+      output[i] = x;
+    }
+  };
+
+  std::array<Section, NumSections> mSections;
+  std::vector<PairState> mState;
+};
+}; // namespace biquad
+}; // namespace dsp
@@ -0,0 +1,1209 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioDSPTools/dsp/dsp.h"
+#include "AudioDSPTools/dsp/Resample.h"
+#include "AudioDSPTools/dsp/wav.h"
+
+#include "architecture.hpp"
+#include "MappedWav.h"
+#include "Spectral.h"
+
+#ifdef ARCH_EXT_SSE
+  #include <xmmintrin.h>
+#endif
+
+namespace dsp
+{
+namespace convolution
+{
+// acc += a * b, for spectra that are stored as separate real and imaginary arrays.
+inline void ComplexMultiplyAccumulate(float* accRe, float* accIm, const float* aRe, const float* aIm,
+                                      const float* bRe, const float* bIm, const size_t numBins)
+{
+  size_t i = 0;
+#ifdef ARCH_EXT_SSE
+  for (; i + 4 <= numBins; i += 4)
+  {
+    const __m128 ar = _mm_loadu_ps(aRe + i);
+    const __m128 ai = _mm_loadu_ps(aIm + i);
+    const __m128 br = _mm_loadu_ps(bRe + i);
+    const __m128 bi = _mm_loadu_ps(bIm + i);
+    const __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+    const __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+    _mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+    _mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+  }
+#endif
+  for (; i < numBins; i++)
+  {
+    accRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+    accIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+  }
+};
+
+// The partition size for a host that sends blocks of up to maxBlockSize samples: one partition per block, so that
+// each block costs one forward and one inverse FFT.
+inline size_t GetPartitionSize(const int maxBlockSize)
+{
+  const size_t minSize = 32;
+  const size_t maxSize = 4096;
+  return std::clamp(spectral::NextPowerOfTwo((size_t)std::max(maxBlockSize, 1)), minSize, maxSize);
+};
+
+// An impulse response cut into equal partitions, each transformed to the frequency domain.
+// Doesn't change after it's made, so convolvers can share it (e.g. one per channel).
+class PartitionedKernel
+{
+public:
+  // Allocates; don't call from the real-time loop.
+  PartitionedKernel(const float* ir, const size_t length, const size_t partitionSize)
+  : mPartitionSize(partitionSize)
+  , mNumBins(partitionSize + 1)
+  , mNumPartitions(std::max<size_t>(1, (length + partitionSize - 1) / partitionSize))
+  , mLength(length)
+  {
+    mRe.assign(mNumPartitions * mNumBins, 0.0f);
+    mIm.assign(mNumPartitions * mNumBins, 0.0f);
+    spectral::RealFFT<float> fft(2 * mPartitionSize);
+    std::vector<float> segment(2 * mPartitionSize);
+    std::vector<std::complex<float>> spectrum(mNumBins);
+    for (size_t p = 0; p < mNumPartitions; p++)
+    {
+      // Each partition is zero-padded to twice its length so that the circular convolution doesn't wrap.
+      std::fill(segment.begin(), segment.end(), 0.0f);
+      const size_t start = p * mPartitionSize;
+      const size_t n = std::min(mPartitionSize, length - std::min(length, start));
+      std::copy(ir + start, ir + start + n, segment.begin());
+      fft.Forward(segment.data(), spectrum.data());
+      for (size_t k = 0; k < mNumBins; k++)
+      {
+        mRe[p * mNumBins + k] = spectrum[k].real();
+        mIm[p * mNumBins + k] = spectrum[k].imag();
+      }
+    }
+  };
+
+  size_t GetPartitionSize() const { return mPartitionSize; };
+  size_t GetNumBins() const { return mNumBins; };
+  size_t GetNumPartitions() const { return mNumPartitions; };
+  size_t GetLength() const { return mLength; };
+  const float* GetRe(const size_t partition) const { return mRe.data() + partition * mNumBins; };
+  const float* GetIm(const size_t partition) const { return mIm.data() + partition * mNumBins; };
+
+private:
+  size_t mPartitionSize;
+  size_t mNumBins;
+  size_t mNumPartitions;
+  size_t mLength;
+  std::vector<float> mRe;
+  std::vector<float> mIm;
+};
+
+// Zero-latency uniformly-partitioned convolution (overlap-add with a frequency-domain delay line).
+// Takes any number of samples per call. Each call costs a forward FFT of twice the partition size per input and an
+// inverse one per output; the delayed partitions are only multiplied once per partition's worth of input.
+// With several inputs and outputs (e.g. true stereo), each output is the sum of its inputs convolved with their
+// kernels. Each input is only transformed once and its delay line is shared by every kernel that it feeds.
+// Outputs can be turned off (and their kernels swapped) without losing the inputs' history.
+class UniformConvolver
+{
+public:
+  // Allocates; don't call from the real-time loop.
+  // :param kernels: numOutputs x numInputs, kernels[output * numInputs + input]. nullptr where the input doesn't feed
+  //   the output. They all need to have the same partition size.
+  void SetKernels(const size_t numInputs, const size_t numOutputs,
+                  std::vector<std::shared_ptr<const PartitionedKernel>> kernels)
+  {
+    mNumInputs = numInputs;
+    mNumOutputs = numOutputs;
+    mKernels = std::move(kernels);
+    mKernels.resize(numInputs * numOutputs);
+    mPartitionSize = 0;
+    mNumPartitions = 1;
+    for (const auto& kernel : mKernels)
+      if (kernel != nullptr)
+      {
+        mPartitionSize = kernel->GetPartitionSize();
+        mNumPartitions = std::max(mNumPartitions, kernel->GetNumPartitions());
+      }
+    if (mPartitionSize == 0)
+      return;
+    // One more partition than the kernels need so that the last partition's output can be recomputed when an output
+    // is turned on.
+    mNumSlots = mNumPartitions + 1;
+    const size_t numBins = mPartitionSize + 1;
+    mFFT.Resize(2 * mPartitionSize);
+    mInputs.assign(numInputs, std::vector<float>(mPartitionSize, 0.0f));
+    mOverlaps.assign(numOutputs, std::vector<float>(mPartitionSize, 0.0f));
+    mSegment.assign(2 * mPartitionSize, 0.0f);
+    mSpectrum.assign(numBins, 0.0f);
+    mDelayLinesRe.assign(numInputs, std::vector<float>(mNumSlots * numBins, 0.0f));
+    mDelayLinesIm.assign(numInputs, std::vector<float>(mNumSlots * numBins, 0.0f));
+    mTailsRe.assign(numOutputs, std::vector<float>(numBins, 0.0f));
+    mTailsIm.assign(numOutputs, std::vector<float>(numBins, 0.0f));
+    mSumRe.assign(numBins, 0.0f);
+    mSumIm.assign(numBins, 0.0f);
+    mActive.assign(numOutputs, 1);
+    mActivating.assign(numOutputs, 0);
+    Reset();
+  };
+
+  // One input, one output
+  void SetKernel(std::shared_ptr<const PartitionedKernel> kernel) { SetKernels(1, 1, {std::move(kernel)}); };
+
+  size_t GetNumInputs() const { return mNumInputs; };
+  size_t GetNumOutputs() const { return mNumOutputs; };
+
+  // Outputs that are off aren't computed and come out as zeros, but the inputs' delay lines keep going. Turning one
+  // back on takes effect at the start of the next partition, and from then on it's exactly as if it had never been
+  // off. Doesn't allocate.
+  void SetOutputActive(const size_t output, const bool active)
+  {
+    if (active && !mActive[output])
+      mActivating[output] = 1;
+    if (!active)
+    {
+      mActive[output] = 0;
+      mActivating[output] = 0;
+    }
+  };
+  // Whether it's being computed (not just turned on)
+  bool IsOutputActive(const size_t output) const { return mActive[output] != 0; };
+
+  // Whether a kernel can be swapped in with SetOutputKernels(): same partition size, and no longer than the ones that
+  // the delay lines were made for.
+  bool CanUseKernel(const PartitionedKernel& kernel) const
+  {
+    return kernel.GetPartitionSize() == mPartitionSize && kernel.GetNumPartitions() <= mNumPartitions;
+  };
+
+  // Swap in new kernels for an output. If it's on, then do it between partitions: the next one's output is then
+  // exactly as if the new kernels had been there all along. Doesn't allocate, but this releases the old ones.
+  // :param kernels: numInputs of them (nullptr where the input doesn't feed the output), all CanUseKernel().
+  void SetOutputKernels(const size_t output, const std::shared_ptr<const PartitionedKernel>* kernels)
+  {
+    for (size_t i = 0; i < mNumInputs; i++)
+      mKernels[output * mNumInputs + i] = kernels[i];
+    // What the last partition spills into the next one was computed with the old kernels.
+    if (mActive[output])
+      mActivating[output] = 1;
+  };
+
+  // Forget the input so far. Doesn't allocate.
+  void Reset()
+  {
+    for (auto* buffers : {&mInputs, &mOverlaps, &mDelayLinesRe, &mDelayLinesIm, &mTailsRe, &mTailsIm})
+      for (auto& buffer : *buffers)
+        std::fill(buffer.begin(), buffer.end(), 0.0f);
+    mInputFill = 0;
+    mCurrent = 0;
+  };
+
+  // One pointer per input and per output. Outputs may be the same as inputs.
+  void Process(const float* const* inputs, float* const* outputs, const size_t numFrames)
+  {
+    if (mPartitionSize == 0)
+    {
+      for (size_t o = 0; o < mNumOutputs; o++)
+        std::fill(outputs[o], outputs[o] + numFrames, 0.0f);
+      return;
+    }
+    const size_t numBins = mPartitionSize + 1;
+    size_t processed = 0;
+    while (processed < numFrames)
+    {
+      const bool startingPartition = mInputFill == 0;
+      const size_t position = mInputFill;
+      const size_t n = std::min(numFrames - processed, mPartitionSize - mInputFill);
+      // All of the inputs are read before any output is written.
+      for (size_t i = 0; i < mNumInputs; i++)
+        std::copy(inputs[i] + processed, inputs[i] + processed + n, mInputs[i].begin() + mInputFill);
+      mInputFill += n;
+
+      // Spectra of the partitions that are filling up
+      for (size_t i = 0; i < mNumInputs; i++)
+      {
+        std::copy(mInputs[i].begin(), mInputs[i].end(), mSegment.begin());
+        std::fill(mSegment.begin() + mPartitionSize, mSegment.end(), 0.0f);
+        mFFT.Forward(mSegment.data(), mSpectrum.data());
+        float* currentRe = mDelayLinesRe[i].data() + mCurrent * numBins;
+        float* currentIm = mDelayLinesIm[i].data() + mCurrent * numBins;
+        for (size_t k = 0; k < numBins; k++)
+        {
+          currentRe[k] = mSpectrum[k].real();
+          currentIm[k] = mSpectrum[k].imag();
+        }
+      }
+
+      // Older partitions don't change until the next one starts, so only multiply them then.
+      if (startingPartition)
+      {
+        for (size_t o = 0; o < mNumOutputs; o++)
+          if (mActivating[o])
+            _Activate(o);
+        for (size_t o = 0; o < mNumOutputs; o++)
+        {
+          if (!mActive[o])
+            continue;
+          std::fill(mTailsRe[o].begin(), mTailsRe[o].end(), 0.0f);
+          std::fill(mTailsIm[o].begin(), mTailsIm[o].end(), 0.0f);
+          for (size_t i = 0; i < mNumInputs; i++)
+          {
+            const PartitionedKernel* kernel = mKernels[o * mNumInputs + i].get();
+            if (kernel == nullptr)
+              continue;
+            for (size_t p = 1; p < kernel->GetNumPartitions(); p++)
+            {
+              const size_t delayed = ((mCurrent + p) % mNumSlots) * numBins;
+              ComplexMultiplyAccumulate(mTailsRe[o].data(), mTailsIm[o].data(), mDelayLinesRe[i].data() + delayed,
+                                        mDelayLinesIm[i].data() + delayed, kernel->GetRe(p), kernel->GetIm(p),
+                                        numBins);
+            }
+          }
+        }
+      }
+
+      const bool finishingPartition = mInputFill == mPartitionSize;
+      for (size_t o = 0; o < mNumOutputs; o++)
+      {
+        if (!mActive[o])
+        {
+          std::fill(outputs[o] + processed, outputs[o] + processed + n, 0.0f);
+          continue;
+        }
+        std::copy(mTailsRe[o].begin(), mTailsRe[o].end(), mSumRe.begin());
+        std::copy(mTailsIm[o].begin(), mTailsIm[o].end(), mSumIm.begin());
+        for (size_t i = 0; i < mNumInputs; i++)
+        {
+          const PartitionedKernel* kernel = mKernels[o * mNumInputs + i].get();
+          if (kernel != nullptr)
+            ComplexMultiplyAccumulate(mSumRe.data(), mSumIm.data(), mDelayLinesRe[i].data() + mCurrent * numBins,
+                                      mDelayLinesIm[i].data() + mCurrent * numBins, kernel->GetRe(0),
+                                      kernel->GetIm(0), numBins);
+        }
+        for (size_t k = 0; k < numBins; k++)
+          mSpectrum[k] = std::complex<float>(mSumRe[k], mSumIm[k]);
+        mFFT.Inverse(mSpectrum.data(), mSegment.data());
+
+        float* output = outputs[o] + processed;
+        for (size_t j = 0; j < n; j++)
+          output[j] = mSegment[position + j] + mOverlaps[o][position + j];
+        // What spills past the partition gets added to the next one.
+        if (finishingPartition)
+          std::copy(mSegment.begin() + mPartitionSize, mSegment.end(), mOverlaps[o].begin());
+      }
+
+      if (finishingPartition)
+      {
+        // Done with this partition; it moves down the delay lines.
+        for (auto& input : mInputs)
+          std::fill(input.begin(), input.end(), 0.0f);
+        mInputFill = 0;
+        mCurrent = mCurrent > 0 ? mCurrent - 1 : mNumSlots - 1;
+      }
+      processed += n;
+    }
+  };
+
+  // One input, one output. output may be the same as input.
+  void Process(const float* input, float* output, const size_t numFrames) { Process(&input, &output, numFrames); };
+
+private:
+  // At the start of a partition (once the inputs' newest spectra are in): recompute what the last partition's output
+  // would have spilled into this one.
+  void _Activate(const size_t output)
+  {
+    const size_t numBins = mPartitionSize + 1;
+    std::fill(mSumRe.begin(), mSumRe.end(), 0.0f);
+    std::fill(mSumIm.begin(), mSumIm.end(), 0.0f);
+    for (size_t i = 0; i < mNumInputs; i++)
+    {
+      const PartitionedKernel* kernel = mKernels[output * mNumInputs + i].get();
+      if (kernel == nullptr)
+        continue;
+      for (size_t p = 0; p < kernel->GetNumPartitions(); p++)
+      {
+        // The last partition is the one after the current one in the delay line.
+        const size_t delayed = ((mCurrent + 1 + p) % mNumSlots) * numBins;
+        ComplexMultiplyAccumulate(mSumRe.data(), mSumIm.data(), mDelayLinesRe[i].data() + delayed,
+                                  mDelayLinesIm[i].data() + delayed, kernel->GetRe(p), kernel->GetIm(p), numBins);
+      }
+    }
+    for (size_t k = 0; k < numBins; k++)
+      mSpectrum[k] = std::complex<float>(mSumRe[k], mSumIm[k]);
+    mFFT.Inverse(mSpectrum.data(), mSegment.data());
+    std::copy(mSegment.begin() + mPartitionSize, mSegment.end(), mOverlaps[output].begin());
+    mActive[output] = 1;
+    mActivating[output] = 0;
+  };
+
+  size_t mNumInputs = 0;
+  size_t mNumOutputs = 0;
+  std::vector<std::shared_ptr<const PartitionedKernel>> mKernels;
+  size_t mPartitionSize = 0;
+  // Of the longest kernel
+  size_t mNumPartitions = 1;
+  // In the delay lines
+  size_t mNumSlots = 2;
+  spectral::RealFFT<float> mFFT;
+  // Per input: the partition that's filling up
+  std::vector<std::vector<float>> mInputs;
+  size_t mInputFill = 0;
+  // Per output: second half of the last full partition's result
+  std::vector<std::vector<float>> mOverlaps;
+  std::vector<float> mSegment;
+  std::vector<std::complex<float>> mSpectrum;
+  // Per input: spectra of the most recent partitions; mCurrent is the newest.
+  std::vector<std::vector<float>> mDelayLinesRe;
+  std::vector<std::vector<float>> mDelayLinesIm;
+  size_t mCurrent = 0;
+  // Per output: contribution of the older partitions to the current one
+  std::vector<std::vector<float>> mTailsRe;
+  std::vector<std::vector<float>> mTailsIm;
+  std::vector<float> mSumRe;
+  std::vector<float> mSumIm;
+  // Per output: whether it's computed, and whether it's been turned on but the next partition hasn't started yet
+  std::vector<char> mActive;
+  std::vector<char> mActivating;
+};
+
+// IRs split for TwoStageConvolver: the heads in small partitions, the rest in big ones.
+// Like UniformConvolver's kernels, they're numOutputs x numInputs, [output * numInputs + input].
+// Doesn't change after it's made, so it can be shared.
+struct TwoStageKernel
+{
+  size_t numInputs = 0;
+  size_t numOutputs = 0;
+  std::vector<std::shared_ptr<const PartitionedKernel>> heads;
+  // Empty if the IRs are short enough for the heads to cover all of them
+  std::vector<std::shared_ptr<const PartitionedKernel>> tails;
+  // Where the tails start in the IRs (twice their partition size)
+  size_t tailStart = 0;
+};
+
+// Allocates; don't call from the real-time loop.
+// :param irs: The distinct IRs
+// :param layout: numOutputs x numInputs indices into irs ([output * numInputs + input]), or -1 where the input doesn't
+//   feed the output. IRs that are used more than once are only partitioned once.
+// :param maxBlockSize: Largest block the host will send
+inline TwoStageKernel MakeTwoStageKernel(const std::vector<std::vector<float>>& irs, const std::vector<int>& layout,
+                                         const size_t numInputs, const size_t numOutputs, const int maxBlockSize)
+{
+  TwoStageKernel kernel;
+  kernel.numInputs = numInputs;
+  kernel.numOutputs = numOutputs;
+  const size_t headPartitionSize = GetPartitionSize(maxBlockSize);
+  const size_t minTailPartitionSize = 1024;
+  const size_t tailPartitionSize = std::max(8 * headPartitionSize, minTailPartitionSize);
+  size_t maxLength = 0;
+  for (const auto& ir : irs)
+    maxLength = std::max(maxLength, ir.size());
+  // The tail starts two of its partitions in so that each of its partitions has a partition's worth of time to be
+  // computed before any of it is needed.
+  const bool hasTail = maxLength > 2 * tailPartitionSize;
+  kernel.tailStart = hasTail ? 2 * tailPartitionSize : 0;
+
+  std::vector<std::shared_ptr<const PartitionedKernel>> heads(irs.size()), tails(irs.size());
+  for (size_t k = 0; k < irs.size(); k++)
+  {
+    const std::vector<float>& ir = irs[k];
+    const size_t headLength = hasTail ? std::min(ir.size(), kernel.tailStart) : ir.size();
+    heads[k] = std::make_shared<const PartitionedKernel>(ir.data(), headLength, headPartitionSize);
+    if (hasTail && ir.size() > kernel.tailStart)
+      tails[k] = std::make_shared<const PartitionedKernel>(
+        ir.data() + kernel.tailStart, ir.size() - kernel.tailStart, tailPartitionSize);
+  }
+  kernel.heads.resize(numInputs * numOutputs);
+  if (hasTail)
+    kernel.tails.resize(numInputs * numOutputs);
+  for (size_t j = 0; j < kernel.heads.size() && j < layout.size(); j++)
+  {
+    if (layout[j] < 0 || (size_t)layout[j] >= irs.size())
+      continue;
+    kernel.heads[j] = heads[layout[j]];
+    if (hasTail)
+      kernel.tails[j] = tails[layout[j]];
+  }
+  return kernel;
+};
+
+// A TwoStageConvolver's tail and the jobs that convolve it, one of the tail's partitions at a time. The convolver
+// (on the audio thread) fills the jobs and picks up their results; TailWorker runs them. It's shared between the two
+// so that the convolver can go away without waiting for a job that's running.
+class TailJobs
+{
+public:
+  // Each job has until the start of the partition after it's queued to be done, but more than one can be queued if
+  // the worker's fallen behind.
+  static constexpr size_t kNumSlots = 3;
+
+  enum SlotState
+  {
+    // The convolver's...
+    kFree = 0,
+    // ...the worker's, until it's run it...
+    kQueued,
+    // ...and the convolver's again, with the result.
+    kDone
+  };
+  enum PendingActive : char
+  {
+    kNoChange = 0,
+    kOn,
+    kOff
+  };
+  struct Slot
+  {
+    std::atomic<int> state = kFree;
+    // The tail hears silence for this many partitions before this one, which were dropped because every slot was
+    // queued.
+    size_t numDropped = 0;
+    // A partition per input and per output
+    std::vector<std::vector<float>> inputs;
+    std::vector<std::vector<float>> outputs;
+    // Changes to the tail that take effect with this partition, per output
+    std::vector<char> setActive;
+    std::vector<char> setKernels;
+    // numOutputs x numInputs
+    std::vector<std::shared_ptr<const PartitionedKernel>> kernels;
+  };
+
+  // Allocates.
+  TailJobs(const size_t numInputs, const size_t numOutputs,
+           const std::vector<std::shared_ptr<const PartitionedKernel>>& tails)
+  : mNumInputs(numInputs)
+  , mNumOutputs(numOutputs)
+  , mInputPointers(numInputs)
+  , mOutputPointers(numOutputs)
+  {
+    mTail.SetKernels(numInputs, numOutputs, tails);
+    for (const auto& tail : tails)
+      if (tail != nullptr)
+        mPartitionSize = tail->GetPartitionSize();
+    for (auto& slot : mSlots)
+    {
+      slot.inputs.assign(numInputs, std::vector<float>(mPartitionSize, 0.0f));
+      slot.outputs.assign(numOutputs, std::vector<float>(mPartitionSize, 0.0f));
+      slot.setActive.assign(numOutputs, kNoChange);
+      slot.setKernels.assign(numOutputs, 0);
+      slot.kernels.resize(numInputs * numOutputs);
+    }
+    mZeros.assign(mPartitionSize, 0.0f);
+    mScratch.assign(numOutputs, std::vector<float>(mPartitionSize, 0.0f));
+  };
+
+  size_t GetPartitionSize() const { return mPartitionSize; };
+  const UniformConvolver& GetTail() const { return mTail; };
+  // Only while nothing's ever been queued (the worker hasn't touched it)
+  UniformConvolver& GetTailBeforeJobs() { return mTail; };
+  Slot& GetSlot(const uint64_t sequence) { return mSlots[sequence % kNumSlots]; };
+
+  // Set when the convolver's gone; the worker lets go of it.
+  std::atomic<bool> detached = false;
+
+  // Worker. Runs whatever's queued, in order.
+  // :return: Whether anything was
+  bool RunQueued()
+  {
+    bool ran = false;
+    while (true)
+    {
+      Slot& slot = GetSlot(mNextToRun);
+      if (slot.state.load(std::memory_order_acquire) != kQueued)
+        return ran;
+      _Run(slot);
+      slot.state.store(kDone, std::memory_order_release);
+      mNextToRun++;
+      ran = true;
+    }
+  };
+
+private:
+  void _Run(Slot& slot)
+  {
+    for (size_t o = 0; o < mNumOutputs; o++)
+      mOutputPointers[o] = mScratch[o].data();
+    for (size_t i = 0; i < mNumInputs; i++)
+      mInputPointers[i] = mZeros.data();
+    for (size_t d = 0; d < slot.numDropped; d++)
+      mTail.Process(mInputPointers.data(), mOutputPointers.data(), mPartitionSize);
+    for (size_t o = 0; o < mNumOutputs; o++)
+    {
+      if (slot.setKernels[o])
+      {
+        mTail.SetOutputKernels(o, slot.kernels.data() + o * mNumInputs);
+        // Let go of them here rather than on the audio thread.
+        for (size_t i = 0; i < mNumInputs; i++)
+          slot.kernels[o * mNumInputs + i] = nullptr;
+        slot.setKernels[o] = 0;
+      }
+      if (slot.setActive[o] != kNoChange)
+      {
+        mTail.SetOutputActive(o, slot.setActive[o] == kOn);
+        slot.setActive[o] = kNoChange;
+      }
+    }
+    for (size_t i = 0; i < mNumInputs; i++)
+      mInputPointers[i] = slot.inputs[i].data();
+    for (size_t o = 0; o < mNumOutputs; o++)
+      mOutputPointers[o] = slot.outputs[o].data();
+    mTail.Process(mInputPointers.data(), mOutputPointers.data(), mPartitionSize);
+  };
+
+  size_t mNumInputs;
+  size_t mNumOutputs;
+  size_t mPartitionSize = 0;
+  UniformConvolver mTail;
+  Slot mSlots[kNumSlots];
+  // Worker only
+  uint64_t mNextToRun = 0;
+  std::vector<const float*> mInputPointers;
+  std::vector<float*> mOutputPointers;
+  std::vector<float> mZeros;
+  std::vector<std::vector<float>> mScratch;
+};
+
+// The one background thread that runs every TwoStageConvolver's tail jobs. It sleeps until an audio thread queues
+// something, so idle (or sleeping) plugins cost nothing.
+class TailWorker
+{
+public:
+  static TailWorker& Get()
+  {
+    static TailWorker worker;
+    return worker;
+  };
+
+  // Allocates and takes a lock; not from the audio thread.
+  void Add(std::shared_ptr<TailJobs> jobs)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mJobs.push_back(std::move(jobs));
+  };
+
+  // Audio thread: something's been queued (or detached). Doesn't wait or allocate.
+  void Notify()
+  {
+    mSignal.fetch_add(1, std::memory_order_release);
+    // Without the lock, this can land between the worker checking mSignal and waiting, and be lost. It doesn't wait
+    // long for the next one, though (see kPollInterval).
+    mCondition.notify_one();
+  };
+
+  ~TailWorker()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+    }
+    mCondition.notify_one();
+    if (mThread.joinable())
+      mThread.join();
+  };
+
+  TailWorker(const TailWorker&) = delete;
+  TailWorker& operator=(const TailWorker&) = delete;
+
+private:
+  // How long it sleeps before looking at mSignal again, in case it missed a Notify(). Well under the shortest tail
+  // partition (1024 samples, 5.3ms at 192kHz), so a missed one makes the job late by this much, not a partition.
+  static constexpr std::chrono::milliseconds kPollInterval{1};
+
+  TailWorker() { mThread = std::thread([this]() { _Run(); }); };
+
+  void _Run()
+  {
+    std::vector<std::shared_ptr<TailJobs>> jobs;
+    uint64_t seen = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (!mCondition.wait_for(lock, kPollInterval,
+                                 [&]() { return mStopping || mSignal.load(std::memory_order_acquire) != seen; }))
+          continue;
+        if (mStopping)
+          break;
+        seen = mSignal.load(std::memory_order_acquire);
+        mJobs.erase(std::remove_if(mJobs.begin(), mJobs.end(), [](const auto& j) { return j->detached.load(); }),
+                    mJobs.end());
+        jobs = mJobs;
+      }
+      // Until there's nothing left
+      bool ran = true;
+      while (ran)
+      {
+        ran = false;
+        for (auto& j : jobs)
+          ran = j->RunQueued() || ran;
+      }
+      // (Detached ones are freed here, off the audio thread.)
+      jobs.clear();
+    }
+  };
+
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::atomic<uint64_t> mSignal = 0;
+  bool mStopping = false;
+  std::vector<std::shared_ptr<TailJobs>> mJobs;
+  std::thread mThread;
+};
+
+// Zero-latency convolution with long IRs at small block sizes (two-stage non-uniform partitioning).
+// The heads of the IRs are convolved with small partitions on the calling (audio) thread. The tails are convolved one
+// big partition at a time by the TailWorker, which has a partition's worth of audio to finish each one. The audio
+// thread never waits for it: if a partition's tail isn't done in time, the tail is silent for that partition (and
+// the late result is thrown away), and if the worker's so far behind that there's nowhere to queue the next one, the
+// tail hears silence in its place. Nothing's added to the latency either way; what's lost is a partition of the
+// tail's output (or input). GetNumMissedDeadlines() counts these.
+// Like UniformConvolver, outputs can be turned off and have their kernels swapped.
+class TwoStageConvolver
+{
+public:
+  // Allocates and registers the tail (if there is one) with the TailWorker; don't call from the real-time loop.
+  TwoStageConvolver(const TwoStageKernel& kernel)
+  : mNumInputs(kernel.numInputs)
+  , mNumOutputs(kernel.numOutputs)
+  , mInputPointers(kernel.numInputs)
+  , mOutputPointers(kernel.numOutputs)
+  , mTailStart(kernel.tailStart)
+  , mRequestedActive(kernel.numOutputs, 1)
+  , mPendingActive(kernel.numOutputs, TailJobs::kNoChange)
+  , mPendingKernels(kernel.numOutputs, 0)
+  , mHeadPendingActive(kernel.numOutputs, TailJobs::kNoChange)
+  , mHeadPendingKernels(kernel.numOutputs, 0)
+  , mPendingHeads(kernel.numInputs * kernel.numOutputs)
+  , mPendingTails(kernel.numInputs * kernel.numOutputs)
+  {
+    mHead.SetKernels(mNumInputs, mNumOutputs, kernel.heads);
+    if (kernel.tails.empty())
+      return;
+    mTailJobs = std::make_shared<TailJobs>(mNumInputs, mNumOutputs, kernel.tails);
+    mTailPartitionSize = mTailJobs->GetPartitionSize();
+    mTailInput.assign(mNumInputs, std::vector<float>(mTailPartitionSize, 0.0f));
+    mTailOutput.assign(mNumOutputs, std::vector<float>(mTailPartitionSize, 0.0f));
+    TailWorker::Get().Add(mTailJobs);
+  };
+
+  // Doesn't wait for the worker (it lets go of the tail when it's done with it).
+  ~TwoStageConvolver()
+  {
+    if (mTailJobs == nullptr)
+      return;
+    mTailJobs->detached = true;
+    TailWorker::Get().Notify();
+  };
+
+  TwoStageConvolver(const TwoStageConvolver&) = delete;
+  TwoStageConvolver& operator=(const TwoStageConvolver&) = delete;
+
+  size_t GetNumInputs() const { return mNumInputs; };
+  size_t GetNumOutputs() const { return mNumOutputs; };
+
+  // See UniformConvolver::SetOutputActive(). With a tail, this waits for the tail's partitions: the tail switches at
+  // the start of its next one, and the head one partition later, when what the tail computed since starts playing.
+  // Asking for what was last asked for does nothing, so it's fine to call every block.
+  // Call from the thread that calls Process().
+  void SetOutputActive(const size_t output, const bool active)
+  {
+    if ((mRequestedActive[output] != 0) == active)
+      return;
+    mRequestedActive[output] = active ? 1 : 0;
+    // (Nothing's been handed to the worker yet before the first partition's done.)
+    if (mTailPartitionSize == 0 || mNextSequence == 0)
+    {
+      mHead.SetOutputActive(output, active);
+      if (mTailPartitionSize > 0)
+        mTailJobs->GetTailBeforeJobs().SetOutputActive(output, active);
+      return;
+    }
+    mPendingActive[output] = active ? TailJobs::kOn : TailJobs::kOff;
+  };
+  // Whether it's being computed, i.e. it's been turned on and that (and any new kernels) has taken effect
+  bool IsOutputActive(const size_t output) const
+  {
+    return mHead.IsOutputActive(output) && mPendingActive[output] == TailJobs::kNoChange
+           && mHeadPendingActive[output] == TailJobs::kNoChange && !mPendingKernels[output]
+           && !mHeadPendingKernels[output];
+  };
+
+  // Swap in an output's kernels from another TwoStageKernel. It needs to have been made for the same block size, and
+  // with the same tail start and no longer kernels; otherwise nothing changes. Like SetOutputActive(), this waits for
+  // the tail's partitions if there's a tail, which makes swapping an output that's on seamless. (Without a tail, it's
+  // only exact from the start of the next partition.)
+  // Call from the thread that calls Process(). Doesn't allocate.
+  // :return: Whether the kernels fit
+  bool SetOutputKernels(const size_t output, const TwoStageKernel& kernel)
+  {
+    if (kernel.numInputs != mNumInputs || kernel.numOutputs != mNumOutputs || kernel.tailStart != mTailStart
+        || kernel.tails.empty() != (mTailPartitionSize == 0))
+      return false;
+    for (size_t i = 0; i < mNumInputs; i++)
+    {
+      const size_t j = output * mNumInputs + i;
+      if ((kernel.heads[j] != nullptr && !mHead.CanUseKernel(*kernel.heads[j]))
+          || (!kernel.tails.empty() && kernel.tails[j] != nullptr
+              && !mTailJobs->GetTail().CanUseKernel(*kernel.tails[j])))
+        return false;
+    }
+    if (mTailPartitionSize == 0 || mNextSequence == 0)
+    {
+      // Both at once
+      mHead.SetOutputKernels(output, kernel.heads.data() + output * mNumInputs);
+      if (mTailPartitionSize > 0)
+        mTailJobs->GetTailBeforeJobs().SetOutputKernels(output, kernel.tails.data() + output * mNumInputs);
+      return true;
+    }
+    for (size_t i = 0; i < mNumInputs; i++)
+    {
+      const size_t j = output * mNumInputs + i;
+      mPendingHeads[j] = kernel.heads[j];
+      mPendingTails[j] = kernel.tails[j];
+    }
+    mPendingKernels[output] = 1;
+    return true;
+  };
+
+  // How many of the tail's partitions were late (and silent) or dropped because the worker fell behind
+  uint64_t GetNumMissedDeadlines() const { return mNumMissedDeadlines; };
+
+  // One pointer per input and per output. Outputs may be the same as the inputs.
+  void Process(const float* const* inputs, float* const* outputs, const size_t numFrames)
+  {
+    if (mTailPartitionSize == 0)
+    {
+      mHead.Process(inputs, outputs, numFrames);
+      return;
+    }
+    size_t processed = 0;
+    while (processed < numFrames)
+    {
+      // Don't go past the end of the tail's partition
+      const size_t n = std::min(numFrames - processed, mTailPartitionSize - mTailFill);
+      for (size_t i = 0; i < mNumInputs; i++)
+      {
+        mInputPointers[i] = inputs[i] + processed;
+        std::copy(mInputPointers[i], mInputPointers[i] + n, mTailInput[i].begin() + mTailFill);
+      }
+      for (size_t o = 0; o < mNumOutputs; o++)
+        mOutputPointers[o] = outputs[o] + processed;
+      mHead.Process(mInputPointers.data(), mOutputPointers.data(), n);
+      for (size_t o = 0; o < mNumOutputs; o++)
+      {
+        const float* tail = mTailOutput[o].data() + mTailFill;
+        for (size_t j = 0; j < n; j++)
+          mOutputPointers[o][j] += tail[j];
+      }
+      mTailFill += n;
+      if (mTailFill == mTailPartitionSize)
+      {
+        _AdvanceTail();
+        mTailFill = 0;
+      }
+      processed += n;
+    }
+  };
+
+private:
+  // Audio thread, at the end of each of the tail's partitions. The job that's queued now computes what the tail adds
+  // during the next partition, so changes go to the tail with it and to the head at the start of the next partition.
+  void _AdvanceTail()
+  {
+    // The last job's output plays during the next partition, if it's done.
+    bool late = mNextSequence > 0;
+    if (mNextSequence > 0)
+    {
+      TailJobs::Slot& last = mTailJobs->GetSlot(mNextSequence - 1);
+      if (last.state.load(std::memory_order_acquire) == TailJobs::kDone)
+      {
+        std::swap(mTailOutput, last.outputs);
+        last.state.store(TailJobs::kFree, std::memory_order_release);
+        late = false;
+      }
+    }
+    if (late)
+    {
+      for (auto& output : mTailOutput)
+        std::fill(output.begin(), output.end(), 0.0f);
+      mNumMissedDeadlines++;
+    }
+
+    for (size_t o = 0; o < mNumOutputs; o++)
+    {
+      if (mHeadPendingKernels[o])
+      {
+        mHead.SetOutputKernels(o, mPendingHeads.data() + o * mNumInputs);
+        mHeadPendingKernels[o] = 0;
+      }
+      if (mHeadPendingActive[o] != TailJobs::kNoChange)
+      {
+        mHead.SetOutputActive(o, mHeadPendingActive[o] == TailJobs::kOn);
+        mHeadPendingActive[o] = TailJobs::kNoChange;
+      }
+    }
+
+    // Queue the partition that just filled up, unless the worker's still on the job that was in its slot.
+    TailJobs::Slot& next = mTailJobs->GetSlot(mNextSequence);
+    if (next.state.load(std::memory_order_acquire) == TailJobs::kQueued)
+    {
+      mNumDropped++;
+      mNumMissedDeadlines++;
+      return;
+    }
+    next.numDropped = mNumDropped;
+    mNumDropped = 0;
+    std::swap(next.inputs, mTailInput);
+    for (size_t o = 0; o < mNumOutputs; o++)
+    {
+      if (mPendingKernels[o])
+      {
+        for (size_t i = 0; i < mNumInputs; i++)
+          next.kernels[o * mNumInputs + i] = std::move(mPendingTails[o * mNumInputs + i]);
+        next.setKernels[o] = 1;
+        mHeadPendingKernels[o] = 1;
+        mPendingKernels[o] = 0;
+      }
+      if (mPendingActive[o] != TailJobs::kNoChange)
+      {
+        next.setActive[o] = mPendingActive[o];
+        mHeadPendingActive[o] = mPendingActive[o];
+        mPendingActive[o] = TailJobs::kNoChange;
+      }
+    }
+    next.state.store(TailJobs::kQueued, std::memory_order_release);
+    mNextSequence++;
+    TailWorker::Get().Notify();
+  };
+
+  size_t mNumInputs;
+  size_t mNumOutputs;
+  UniformConvolver mHead;
+  std::shared_ptr<TailJobs> mTailJobs;
+  size_t mTailPartitionSize = 0;
+  std::vector<const float*> mInputPointers;
+  std::vector<float*> mOutputPointers;
+  // Per input: input for the tail's partition that's filling up...
+  std::vector<std::vector<float>> mTailInput;
+  size_t mTailFill = 0;
+  // ...and, per output, the tail's output during this partition.
+  std::vector<std::vector<float>> mTailOutput;
+  size_t mTailStart;
+  // Jobs queued so far
+  uint64_t mNextSequence = 0;
+  // Partitions that couldn't be queued since the last one that was
+  size_t mNumDropped = 0;
+  // Per output: what SetOutputActive() was last asked for...
+  std::vector<char> mRequestedActive;
+  // ...and changes waiting for the start of the tail's next partition, and then the head's turn
+  std::vector<char> mPendingActive;
+  std::vector<char> mPendingKernels;
+  std::vector<char> mHeadPendingActive;
+  std::vector<char> mHeadPendingKernels;
+  std::vector<std::shared_ptr<const PartitionedKernel>> mPendingHeads;
+  std::vector<std::shared_ptr<const PartitionedKernel>> mPendingTails;
+
+  uint64_t mNumMissedDeadlines = 0;
+};
+}; // namespace convolution
+
+// Drop-in replacement for dsp::ImpulseResponse that convolves with FFTs instead of directly.
+// Mono IRs are applied to each channel on its own (so e.g. left and right don't share history), stereo ones with one
+// channel of the IR per channel, and true-stereo (4-channel) ones from each input channel to each output channel.
+// The IR and its kernel are read-only, so they can also be shared between instances (see IRCache.h).
+class ConvolutionIR : public DSP
+{
+public:
+  // Like dsp::ImpulseResponse::IRData, but with any number of channels. See MakeKernel() for what they're used for.
+  struct IRData
+  {
+    std::vector<std::vector<float>> mRawAudio;
+    double mRawAudioSampleRate = 0.0;
+  };
+
+  // :param maxBlockSize: Largest block the host will send; sets the partition size. (Bigger blocks work, too.)
+  ConvolutionIR(const char* fileName, const double sampleRate, const int maxBlockSize = kDefaultMaxBlockSize)
+  : mSampleRate(sampleRate)
+  , mMaxBlockSize(maxBlockSize)
+  {
+    auto irData = std::make_shared<IRData>();
+    mWavState = dsp::wav::LoadMultichannel(fileName, irData->mRawAudio, irData->mRawAudioSampleRate);
+    if (mWavState != dsp::wav::LoadReturnCode::SUCCESS)
+    {
+      std::cerr << "Failed to load IR at " << fileName << std::endl;
+      return;
+    }
+    mData = std::move(irData);
+    _SetKernel(MakeKernel(*mData, mSampleRate, mMaxBlockSize));
+  };
+
+  ConvolutionIR(const IRData& irData, const double sampleRate, const int maxBlockSize = kDefaultMaxBlockSize)
+  : mData(std::make_shared<const IRData>(irData))
+  , mSampleRate(sampleRate)
+  , mMaxBlockSize(maxBlockSize)
+  , mWavState(dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    _SetKernel(MakeKernel(*mData, mSampleRate, mMaxBlockSize));
+  };
+
+  // Share an IR and a kernel that MakeKernel() made for it with the same sample rate and block size.
+  ConvolutionIR(std::shared_ptr<const IRData> irData, const convolution::TwoStageKernel& kernel,
+                const double sampleRate, const int maxBlockSize = kDefaultMaxBlockSize)
+  : mData(std::move(irData))
+  , mSampleRate(sampleRate)
+  , mMaxBlockSize(maxBlockSize)
+  , mWavState(dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    _SetKernel(kernel);
+  };
+
+  // Resample and scale the same way as dsp::ImpulseResponse so that IRs sound the same, then partition.
+  // How the IR's channels are used:
+  //   1: the same IR on both channels
+  //   2: left on left, right on right
+  //   4 (true stereo): L->L, L->R, R->L, R->R
+  // Anything else is used as a mono IR (its first channel).
+  // Allocates; don't call from the real-time loop.
+  // :param filterLength: If not 0, also make a second set of outputs for the IR convolved with a filter of this many
+  //   samples (e.g. an EQ's impulse response). See SetFilter(); until then, the filter does nothing.
+  static convolution::TwoStageKernel MakeKernel(const IRData& irData, const double sampleRate, const int maxBlockSize,
+                                                const size_t filterLength = 0)
+  {
+    std::vector<int> layout;
+    std::vector<std::vector<float>> irs = Resample(irData, sampleRate, layout);
+    if (filterLength == 0)
+      return convolution::MakeTwoStageKernel(irs, layout, kMaxChannels, kMaxChannels, maxBlockSize);
+    // Same IRs, but as long as they'll be with the filter
+    const size_t numIRs = irs.size();
+    for (size_t k = 0; k < numIRs; k++)
+    {
+      std::vector<float> padded(irs[k]);
+      padded.resize(irs[k].size() + filterLength - 1, 0.0f);
+      irs.push_back(std::move(padded));
+    }
+    const size_t numLayout = layout.size();
+    for (size_t j = 0; j < numLayout; j++)
+      layout.push_back(layout[j] + (int)numIRs);
+    return convolution::MakeTwoStageKernel(irs, layout, kMaxChannels, 2 * kMaxChannels, maxBlockSize);
+  };
+
+  // The filtered outputs' kernels for a filter, to give to SetFilter(): the IR convolved with it. Its length needs to
+  // be the filterLength that the IR's kernel was made with.
+  // Allocates; don't call from the real-time loop.
+  static convolution::TwoStageKernel MakeFilteredKernel(const IRData& irData, const double sampleRate,
+                                                        const int maxBlockSize, const std::vector<float>& filter)
+  {
+    std::vector<int> layout;
+    std::vector<std::vector<float>> irs = Resample(irData, sampleRate, layout);
+    for (auto& ir : irs)
+      ir = _Convolve(ir, filter);
+    // Only the filtered outputs
+    std::vector<int> filteredLayout(layout.size(), -1);
+    filteredLayout.insert(filteredLayout.end(), layout.begin(), layout.end());
+    return convolution::MakeTwoStageKernel(irs, filteredLayout, kMaxChannels, 2 * kMaxChannels, maxBlockSize);
+  };
+
+  // Outputs are the IR's; if it has filtered ones, then they're at GetFilteredOutputs().
+  // Its buffers were all sized for the max block size when the kernel was set, so blocks can't be any bigger than
+  // that (see CanProcess()).
+  DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const size_t numChannels, const size_t numFrames) override
+  {
+    _PrepareBuffers(numChannels, numFrames);
+    if (mConvolver == nullptr)
+    {
+      for (size_t c = 0; c < numChannels; c++)
+        std::fill(mOutputs[c].begin(), mOutputs[c].end(), 0.0);
+      return _GetPointers();
+    }
+    assert(numFrames <= mScratch[0].size());
+    const size_t numConvolved = std::min(numChannels, kMaxChannels);
+    for (size_t c = 0; c < numConvolved; c++)
+      for (size_t i = 0; i < numFrames; i++)
+        mScratch[c][i] = (float)inputs[c][i];
+    // Channels that weren't provided are silent.
+    for (size_t c = numConvolved; c < kMaxChannels; c++)
+      std::fill(mScratch[c].begin(), mScratch[c].begin() + numFrames, 0.0f);
+    mConvolver->Process(mScratchPointers, mScratchPointers, numFrames);
+    for (size_t c = 0; c < numConvolved; c++)
+      for (size_t i = 0; i < numFrames; i++)
+        mOutputs[c][i] = mScratch[c][i];
+    if (HasFilteredOutputs())
+      for (size_t c = 0; c < kMaxChannels; c++)
+        for (size_t i = 0; i < numFrames; i++)
+          mFilteredOutputs[c][i] = mScratch[kMaxChannels + c][i];
+    // More channels than we're set up for; copy the first one like dsp::ImpulseResponse does.
+    for (size_t c = numConvolved; c < numChannels; c++)
+      std::copy(mOutputs[0].begin(), mOutputs[0].begin() + numFrames, mOutputs[c].begin());
+    return _GetPointers();
+  };
+
+  // The IR and the IR convolved with a filter (e.g. a static EQ) both run off of the same input history, so switching
+  // from one to the other (or crossfading) is seamless. Whichever isn't on costs next to nothing.
+  bool HasFilteredOutputs() const { return mConvolver != nullptr && mConvolver->GetNumOutputs() > kMaxChannels; };
+  // (From the last Process(), for its numFrames; one per channel)
+  DSP_SAMPLE** GetFilteredOutputs() { return mFilteredPointers; };
+  // Filtered outputs start off; the IR's start on. These take effect within a partition (or the tail's partition);
+  // until then, the outputs are still on (off).
+  void SetFilteredActive(const bool active) { _SetActive(kMaxChannels, active); };
+  void SetUnfilteredActive(const bool active) { _SetActive(0, active); };
+  bool IsFilteredActive() const { return HasFilteredOutputs() && mConvolver->IsOutputActive(kMaxChannels); };
+  bool IsUnfilteredActive() const { return mConvolver != nullptr && mConvolver->IsOutputActive(0); };
+  // Use the filter that a kernel from MakeFilteredKernel() was made with. The filtered outputs should be off.
+  // Doesn't allocate.
+  // :return: Whether the kernel fits (same IR, sample rate, block size, and filter length).
+  bool SetFilter(const convolution::TwoStageKernel& kernel)
+  {
+    if (!HasFilteredOutputs())
+      return false;
+    for (size_t c = 0; c < kMaxChannels; c++)
+      if (!mConvolver->SetOutputKernels(kMaxChannels + c, kernel))
+        return false;
+    return true;
+  };
+
+  // The IR's channels at the sample rate (with dsp::ImpulseResponse's gain), i.e. what gets convolved, and which of
+  // them goes from each input to each output ([output * 2 + input], -1 for none).
+  // Allocates; don't call from the real-time loop.
+  static std::vector<std::vector<float>> Resample(const IRData& irData, const double sampleRate,
+                                                  std::vector<int>& layout)
+  {
+    size_t numUsed = 1;
+    switch (irData.mRawAudio.size())
+    {
+      case 2:
+        layout = {0, -1, -1, 1};
+        numUsed = 2;
+        break;
+      case 4:
+        layout = {0, 2, 1, 3};
+        numUsed = 4;
+        break;
+      default:
+        if (irData.mRawAudio.size() > 1)
+          std::cerr << "IR has " << irData.mRawAudio.size() << " channels; using the first one" << std::endl;
+        layout = {0, -1, -1, 0};
+        break;
+    }
+    std::vector<std::vector<float>> irs(std::min(numUsed, irData.mRawAudio.size()));
+    const float gain = (float)(std::pow(10.0, -18 * 0.05) * 48000 / sampleRate);
+    for (size_t k = 0; k < irs.size(); k++)
+    {
+      const std::vector<float>& raw = irData.mRawAudio[k];
+      std::vector<float>& resampled = irs[k];
+      if (irData.mRawAudioSampleRate == sampleRate)
+        resampled = raw;
+      else
+      {
+        // Pad with zeros so that the cubic interpolation has something at the ends.
+        std::vector<float> padded(raw.size() + 2, 0.0f);
+        std::copy(raw.begin(), raw.end(), padded.begin() + 1);
+        dsp::ResampleCubic<float>(padded, irData.mRawAudioSampleRate, sampleRate, 0.0, resampled);
+      }
+      resampled.resize(std::min(resampled.size(), kMaxLength));
+      for (float& x : resampled)
+        x *= gain;
+    }
+    return irs;
+  };
+
+  IRData GetData() { return mData != nullptr ? *mData : IRData(); };
+  // What the kernel was made from
+  const IRData* GetDataPointer() const { return mData.get(); };
+  double GetSampleRate() const { return mSampleRate; };
+  // Whether it was made for this sample rate and for blocks this big
+  bool CanProcess(const double sampleRate, const int numFrames) const
+  {
+    return sampleRate == mSampleRate && numFrames <= std::max(mMaxBlockSize, 1);
+  };
+  // How long (in samples) the longest of its IRs is at this sample rate, i.e. how long it rings after the input stops
+  size_t GetLength() const { return mLength; };
+  dsp::wav::LoadReturnCode GetWavState() const { return mWavState; };
+
+private:
+  static constexpr int kDefaultMaxBlockSize = 512;
+  static constexpr size_t kMaxChannels = 2;
+  // FFTs and computing the tail in the background make long IRs (rooms, plates) affordable, so this is a lot longer
+  // than dsp::ImpulseResponse's 8192: about 10 seconds at 48kHz.
+  static constexpr size_t kMaxLength = 1 << 19;
+
+
+  // Linear convolution, with an FFT
+  static std::vector<float> _Convolve(const std::vector<float>& a, const std::vector<float>& b)
+  {
+    if (a.empty() || b.empty())
+      return {};
+    const size_t length = a.size() + b.size() - 1;
+    spectral::RealFFT<double> fft(spectral::NextPowerOfTwo(length));
+    std::vector<double> x(fft.GetSize(), 0.0);
+    std::vector<std::complex<double>> spectrumA(fft.GetNumBins()), spectrumB(fft.GetNumBins());
+    std::copy(a.begin(), a.end(), x.begin());
+    fft.Forward(x.data(), spectrumA.data());
+    std::fill(x.begin(), x.end(), 0.0);
+    std::copy(b.begin(), b.end(), x.begin());
+    fft.Forward(x.data(), spectrumB.data());
+    for (size_t k = 0; k < spectrumA.size(); k++)
+      spectrumA[k] *= spectrumB[k];
+    fft.Inverse(spectrumA.data(), x.data());
+    return std::vector<float>(x.begin(), x.begin() + length);
+  };
+
+  void _SetActive(const size_t firstOutput, const bool active)
+  {
+    if (mConvolver == nullptr || firstOutput + kMaxChannels > mConvolver->GetNumOutputs())
+      return;
+    for (size_t c = 0; c < kMaxChannels; c++)
+      mConvolver->SetOutputActive(firstOutput + c, active);
+  };
+
+  void _SetKernel(const convolution::TwoStageKernel& kernel)
+  {
+    mConvolver = std::make_unique<convolution::TwoStageConvolver>(kernel);
+    mLength = 0;
+    for (const auto& head : kernel.heads)
+      if (head != nullptr)
+        mLength = std::max(mLength, head->GetLength());
+    for (const auto& tail : kernel.tails)
+      if (tail != nullptr)
+        mLength = std::max(mLength, kernel.tailStart + tail->GetLength());
+    const size_t maxBlockSize = std::max(mMaxBlockSize, 1);
+    for (size_t c = 0; c < 2 * kMaxChannels; c++)
+    {
+      mScratch[c].assign(maxBlockSize, 0.0f);
+      mScratchPointers[c] = mScratch[c].data();
+    }
+    for (size_t c = 0; c < kMaxChannels; c++)
+    {
+      mFilteredOutputs[c].assign(maxBlockSize, 0.0);
+      mFilteredPointers[c] = mFilteredOutputs[c].data();
+    }
+    // The filtered outputs are only for switching to.
+    SetFilteredActive(false);
+    _PrepareBuffers(kMaxChannels, maxBlockSize);
+  };
+
+  std::shared_ptr<const IRData> mData;
+  double mSampleRate;
+  int mMaxBlockSize;
+  dsp::wav::LoadReturnCode mWavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
+  std::unique_ptr<convolution::TwoStageConvolver> mConvolver;
+  size_t mLength = 0;
+  // The input, then the IR's outputs (in place), then the filtered ones
+  std::vector<float> mScratch[2 * kMaxChannels];
+  float* mScratchPointers[2 * kMaxChannels] = {};
+  std::vector<DSP_SAMPLE> mFilteredOutputs[kMaxChannels];
+  DSP_SAMPLE* mFilteredPointers[kMaxChannels] = {};
+};
+}; // namespace dsp
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace dsp
+{
+// Two copies of something: one that a reader (e.g. the audio thread) is using, and one that gets written and then
+// swapped in. The reader never waits, locks, or allocates. Writers take turns, and wait (briefly) if the reader's
+// still using the copy they'd write over because it got it just before the last swap.
+template <typename T>
+class DoubleBuffer
+{
+public:
+  // Writers. write(T&) gets the copy that isn't being read, with whatever was written to it two writes ago, and
+  // should overwrite all of it. It's swapped in once write() returns.
+  template <typename Function>
+  void Write(Function&& write)
+  {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    const int back = 1 - mFront.load(std::memory_order_relaxed);
+    while (mReading.load() == back)
+      std::this_thread::yield();
+    write(mCopies[back]);
+    mFront.store(back);
+  };
+
+  // Reader only. The latest copy, which stays put until EndRead().
+  const T& BeginRead()
+  {
+    int front = mFront.load();
+    // If it was swapped before the reader said which one it was reading, then a writer might already be writing
+    // over that one.
+    while (true)
+    {
+      mReading.store(front);
+      const int check = mFront.load();
+      if (check == front)
+        break;
+      front = check;
+    }
+    return mCopies[front];
+  };
+  void EndRead() { mReading.store(-1, std::memory_order_release); };
+
+private:
+  T mCopies[2];
+  std::atomic<int> mFront = 0;
+  // Which one the reader has (-1 for neither)
+  std::atomic<int> mReading = -1;
+  std::mutex mWriteMutex;
+};
+}; // namespace dsp
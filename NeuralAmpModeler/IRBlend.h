@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "AudioDSPTools/dsp/Resample.h"
+
+namespace dsp
+{
+namespace ir_blend
+{
+// How an IR goes into the blend
+struct Layer
+{
+  double gainDB = 0.0;
+  // E.g. to line up mics that were at different distances from the speaker. Rounded to whole samples.
+  double delayMs = 0.0;
+  // Flip the polarity
+  bool invert = false;
+
+  bool operator==(const Layer& other) const
+  {
+    return gainDB == other.gainDB && delayMs == other.delayMs && invert == other.invert;
+  };
+};
+
+// One of the IR files in a blend
+struct File
+{
+  std::string path;
+  Layer layer;
+
+  bool operator==(const File& other) const { return path == other.path && layer == other.layer; };
+};
+
+// How many of an IR's channels mean something (see ConvolutionIR::MakeKernel()): 1 (mono), 2 (stereo), or 4 (true
+// stereo). Anything else is used as mono.
+inline size_t GetNumChannelsUsed(const size_t numChannels)
+{
+  return (numChannels == 2 || numChannels == 4) ? numChannels : 1;
+};
+
+// The same IR with more channels: mono is the same on both sides, and stereo is true stereo that doesn't cross over.
+// :param numChannels: 1, 2, or 4, and no fewer than the IR uses
+inline std::vector<std::vector<float>> Widen(const std::vector<std::vector<float>>& channels, const size_t numChannels)
+{
+  const size_t numUsed = GetNumChannelsUsed(channels.size());
+  if (channels.empty() || numUsed >= numChannels)
+    return std::vector<std::vector<float>>(channels.begin(), channels.begin() + std::min(numUsed, channels.size()));
+  const size_t length = channels[0].size();
+  std::vector<std::vector<float>> widened(numChannels, std::vector<float>(length, 0.0f));
+  // Left and right (true stereo goes L->L, L->R, R->L, R->R)
+  const size_t right = numChannels == 4 ? 3 : 1;
+  widened[0] = channels[0];
+  widened[right] = channels[numUsed == 2 ? 1 : 0];
+  return widened;
+};
+
+// Mixes an IR into a blend. The blend gets as many channels as the widest IR in it (see Widen()).
+// Allocates.
+// :param channels: The IR, at irSampleRate
+// :param sum: The blend so far (may be empty), at sampleRate. The IR is resampled to that if it needs to be.
+inline void Add(const std::vector<std::vector<float>>& channels, const double irSampleRate, const Layer& layer,
+                const double sampleRate, std::vector<std::vector<float>>& sum)
+{
+  if (channels.empty())
+    return;
+  const size_t numChannels = std::max(GetNumChannelsUsed(channels.size()), sum.empty() ? 1 : sum.size());
+  std::vector<std::vector<float>> ir = Widen(channels, numChannels);
+  if (!sum.empty())
+    sum = Widen(sum, numChannels);
+  else
+    sum.resize(numChannels);
+
+  const float gain = (float)((layer.invert ? -1.0 : 1.0) * std::pow(10.0, layer.gainDB / 20.0));
+  const size_t delay = (size_t)std::round(std::max(layer.delayMs, 0.0) * 0.001 * sampleRate);
+  for (size_t c = 0; c < numChannels; c++)
+  {
+    std::vector<float> resampled;
+    const std::vector<float>* source = &ir[c];
+    if (irSampleRate != sampleRate)
+    {
+      // Pad with zeros so that the cubic interpolation has something at the ends.
+      std::vector<float> padded(ir[c].size() + 2, 0.0f);
+      std::copy(ir[c].begin(), ir[c].end(), padded.begin() + 1);
+      dsp::ResampleCubic<float>(padded, irSampleRate, sampleRate, 0.0, resampled);
+      source = &resampled;
+    }
+    std::vector<float>& out = sum[c];
+    out.resize(std::max(out.size(), delay + source->size()), 0.0f);
+    for (size_t i = 0; i < source->size(); i++)
+      out[delay + i] += gain * (*source)[i];
+  }
+  // Every channel as long as the longest
+  size_t length = 0;
+  for (const auto& channel : sum)
+    length = std::max(length, channel.size());
+  for (auto& channel : sum)
+    channel.resize(length, 0.0f);
+};
+}; // namespace ir_blend
+}; // namespace dsp
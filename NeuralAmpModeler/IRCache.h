@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Convolution.h"
+#include "IRBlend.h"
+#include "IRPreprocessing.h"
+
+namespace dsp
+{
+// What an IR's kernel was made from: the files (as of when they were last modified), how they were blended and
+// preprocessed, and the sample rate and partitioning that it was made for.
+struct IRCacheKey
+{
+  // Usually just the one (see IRBlend.h)
+  std::vector<ir_blend::File> files;
+  std::vector<std::filesystem::file_time_type> modified;
+  ir_preprocessing::Options options;
+  double sampleRate = 0.0;
+  // convolution::GetPartitionSize() of the max block size
+  size_t partitionSize = 0;
+  // Room left for a filter to be folded into the kernel (see ConvolutionIR::MakeKernel())
+  size_t filterLength = 0;
+
+  bool operator==(const IRCacheKey& other) const
+  {
+    return files == other.files && modified == other.modified && options == other.options
+           && sampleRate == other.sampleRate && partitionSize == other.partitionSize
+           && filterLength == other.filterLength;
+  };
+};
+
+inline IRCacheKey MakeIRCacheKey(const std::vector<ir_blend::File>& files, const ir_preprocessing::Options& options,
+                                 const double sampleRate, const int maxBlockSize, const size_t filterLength = 0)
+{
+  IRCacheKey key;
+  key.files = files;
+  for (const auto& file : files)
+  {
+    std::error_code ec;
+    key.modified.push_back(std::filesystem::last_write_time(std::filesystem::u8path(file.path), ec));
+  }
+  key.options = options;
+  key.sampleRate = sampleRate;
+  key.partitionSize = convolution::GetPartitionSize(maxBlockSize);
+  key.filterLength = filterLength;
+  return key;
+};
+
+// A (preprocessed) IR at its file's sample rate and the kernel made from it for the key's sample rate.
+// Read-only; every ConvolutionIR that uses it just has its own delay lines.
+struct CachedIR
+{
+  IRCacheKey key;
+  std::shared_ptr<const ConvolutionIR::IRData> data;
+  convolution::TwoStageKernel kernel;
+  // What preprocessing did to it (all zeros if the options didn't ask for any), for the settings page
+  ir_preprocessing::Report preprocessing;
+};
+
+// Process-wide, reference-counted cache of IR kernels. Entries live as long as someone's using them.
+// Thread-safe, but takes a lock; don't use it from the audio thread.
+class IRCache
+{
+public:
+  using MakeFunc = std::function<std::shared_ptr<const CachedIR>()>;
+
+  // :param make: Called (without the lock) if nothing's cached for the key. May return nullptr if it fails, in which
+  //   case nothing's cached.
+  // :return: What's cached for the key, or what make() made.
+  std::shared_ptr<const CachedIR> GetOrMake(const IRCacheKey& key, const MakeFunc& make)
+  {
+    if (auto cached = _Find(key))
+      return cached;
+    // Two instances that miss at the same time both make it; the later one wins. Not worth holding the lock for.
+    std::shared_ptr<const CachedIR> made = make();
+    if (made != nullptr)
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mEntries.push_back({key, made});
+    }
+    return made;
+  };
+
+  // The IR in cached, with a kernel for another sample rate and block size. Doesn't read the file again.
+  std::shared_ptr<const CachedIR> GetForSettings(const CachedIR& cached, const double sampleRate,
+                                                 const int maxBlockSize, const size_t filterLength = 0)
+  {
+    IRCacheKey key = cached.key;
+    key.sampleRate = sampleRate;
+    key.partitionSize = convolution::GetPartitionSize(maxBlockSize);
+    key.filterLength = filterLength;
+    return GetOrMake(key, [&]() {
+      auto made = std::make_shared<CachedIR>();
+      made->key = key;
+      made->data = cached.data;
+      made->kernel = ConvolutionIR::MakeKernel(*cached.data, sampleRate, maxBlockSize, filterLength);
+      return std::shared_ptr<const CachedIR>(std::move(made));
+    });
+  };
+
+private:
+  struct Entry
+  {
+    IRCacheKey key;
+    std::weak_ptr<const CachedIR> ir;
+  };
+
+  std::shared_ptr<const CachedIR> _Find(const IRCacheKey& key)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // Forget the ones that nobody's using anymore.
+    mEntries.erase(
+      std::remove_if(mEntries.begin(), mEntries.end(), [](const Entry& entry) { return entry.ir.expired(); }),
+      mEntries.end());
+    for (const auto& entry : mEntries)
+      if (entry.key == key)
+        if (auto ir = entry.ir.lock())
+          return ir;
+    return nullptr;
+  };
+
+  std::mutex mMutex;
+  std::vector<Entry> mEntries;
+};
+}; // namespace dsp
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+#include "Spectral.h"
+
+namespace dsp
+{
+namespace ir_preprocessing
+{
+struct Options
+{
+  // Strip the silence before the IR starts and cut off its tail once it's decayed past the threshold.
+  bool trim = false;
+  // How far below the peak (leading silence) or the total energy (tail) counts as nothing, in dB.
+  double thresholdDB = -80.0;
+  // Replace the IR with its minimum-phase version: same magnitude response, energy as early as possible.
+  bool minimumPhase = false;
+
+  bool Any() const { return trim || minimumPhase; };
+  bool operator==(const Options& other) const
+  {
+    return trim == other.trim && thresholdDB == other.thresholdDB && minimumPhase == other.minimumPhase;
+  };
+};
+
+struct Report
+{
+  size_t originalLength = 0;
+  size_t processedLength = 0;
+  // Of which were leading silence
+  size_t leadingTrimmed = 0;
+  double sampleRate = 0.0;
+
+  // Rough share of the convolution's cost that was saved. Partitioned convolution costs about the same per
+  // partition, so this goes with the length.
+  double GetEstimatedCPUSaved() const
+  {
+    return originalLength == 0 ? 0.0 : 1.0 - (double)processedLength / (double)originalLength;
+  };
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Report& report)
+{
+  const double ms = 1000.0 / report.sampleRate;
+  os << "IR preprocessed: " << report.originalLength << " samples (" << report.originalLength * ms << " ms) -> "
+     << report.processedLength << " samples (" << report.processedLength * ms << " ms), " << report.leadingTrimmed
+     << " samples of leading silence removed, ~" << (int)std::round(100.0 * report.GetEstimatedCPUSaved())
+     << "% less convolution CPU";
+  return os;
+};
+
+// :return: Index of the first sample that isn't silent (relative to the peak)
+inline size_t FindStart(const std::vector<float>& ir, const double thresholdDB)
+{
+  float peak = 0.0f;
+  for (const float x : ir)
+    peak = std::max(peak, std::abs(x));
+  const float threshold = peak * (float)std::pow(10.0, thresholdDB / 20.0);
+  for (size_t i = 0; i < ir.size(); i++)
+    if (std::abs(ir[i]) > threshold)
+      return i;
+  return ir.size();
+};
+
+// :return: Length after which the energy that's left (backward-integrated, like a decay curve) is below the
+//   threshold relative to the total.
+inline size_t FindEnd(const std::vector<float>& ir, const double thresholdDB)
+{
+  double total = 0.0;
+  for (const float x : ir)
+    total += (double)x * x;
+  const double threshold = total * std::pow(10.0, thresholdDB / 10.0);
+  double remaining = 0.0;
+  for (size_t i = ir.size(); i > 0; i--)
+  {
+    remaining += (double)ir[i - 1] * ir[i - 1];
+    if (remaining > threshold)
+      return i;
+  }
+  return 0;
+};
+
+// Apply the options to an IR's channels in place.
+// The channels are trimmed together (from the earliest start to the latest end) so that they stay lined up; for
+// stereo and true-stereo IRs, the delays between them are part of the sound.
+// Allocates; don't call from the real-time loop.
+inline Report Process(std::vector<std::vector<float>>& channels, const double sampleRate, const Options& options)
+{
+  Report report;
+  report.sampleRate = sampleRate;
+  for (const auto& ir : channels)
+    report.originalLength = std::max(report.originalLength, ir.size());
+  for (auto& ir : channels)
+    ir.resize(report.originalLength, 0.0f);
+  if (channels.empty())
+    return report;
+  if (options.trim)
+  {
+    size_t start = report.originalLength;
+    for (const auto& ir : channels)
+      start = std::min(start, FindStart(ir, options.thresholdDB));
+    report.leadingTrimmed = start;
+    for (auto& ir : channels)
+      ir.erase(ir.begin(), ir.begin() + start);
+  }
+  if (options.minimumPhase && channels[0].size() > 1)
+  {
+    for (auto& ir : channels)
+    {
+      std::vector<double> h(ir.begin(), ir.end());
+      spectral::MakeMinimumPhase(h);
+      std::copy(h.begin(), h.end(), ir.begin());
+    }
+  }
+  if (options.trim)
+  {
+    size_t end = 1;
+    for (const auto& ir : channels)
+      end = std::max(end, FindEnd(ir, options.thresholdDB));
+    if (end < channels[0].size())
+    {
+      // Fade out so that cutting it off doesn't click.
+      const size_t fadeLength = std::min(end, (size_t)(0.001 * sampleRate) + 1);
+      for (auto& ir : channels)
+      {
+        ir.resize(end);
+        for (size_t i = 0; i < fadeLength; i++)
+          ir[ir.size() - 1 - i] *= (float)(0.5 - 0.5 * std::cos(M_PI * (i + 0.5) / fadeLength));
+      }
+    }
+  }
+  report.processedLength = channels[0].size();
+  return report;
+};
+}; // namespace ir_preprocessing
+}; // namespace dsp
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "OutputStage.h"
+#include "StereoNoiseGate.h"
+#include "architecture.hpp"
+
+#ifdef ARCH_EXT_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace dsp
+{
+namespace input_stage
+{
+// The start of the chain in one pass over the block: the input gain, from the host's channels to the two internal
+// ones (mono goes to both; a third and beyond are ignored), the input meter's levels, and the noise gate's detector
+// signal (see stereo_noise_gate::Gate::GetDetectorSignals()). Two frames at a time, one per SIMD lane.
+// :param gain: For the first frame...
+// :param gainRatio: ...and what it's multiplied by for each one after (see Ramp)
+// :param detectorSignals: Where the detector's signal goes, for this link
+inline void Process(const double* const* inputs, const size_t numInputs, double* const* outputs, const size_t numFrames,
+                    const double gain, const double gainRatio, const stereo_noise_gate::Link link,
+                    double* const* detectorSignals, ChannelLevels& levels)
+{
+  levels = ChannelLevels();
+  if (numInputs == 0)
+  {
+    for (size_t c = 0; c < ChannelLevels::kMaxChannels; c++)
+    {
+      std::fill(outputs[c], outputs[c] + numFrames, 0.0);
+      std::fill(detectorSignals[c], detectorSignals[c] + numFrames, 0.0);
+    }
+    return;
+  }
+  const double* inputL = inputs[0];
+  const double* inputR = numInputs > 1 ? inputs[1] : inputs[0];
+  double* outputL = outputs[0];
+  double* outputR = outputs[1];
+  double* detectorL = detectorSignals[0];
+  double* detectorR = detectorSignals[1];
+  double peakL = 0.0, peakR = 0.0, sumSquaresL = 0.0, sumSquaresR = 0.0;
+  double frameGain = gain;
+  size_t s = 0;
+#ifdef ARCH_EXT_SSE2
+  // [frame s, frame s + 1]
+  __m128d g = _mm_set_pd(gain * gainRatio, gain);
+  const __m128d gStep = _mm_set1_pd(gainRatio * gainRatio);
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+  __m128d vPeakL = _mm_setzero_pd(), vPeakR = _mm_setzero_pd();
+  __m128d vSumSquaresL = _mm_setzero_pd(), vSumSquaresR = _mm_setzero_pd();
+  for (; s + 2 <= numFrames; s += 2)
+  {
+    const __m128d l = _mm_mul_pd(g, _mm_loadu_pd(inputL + s));
+    const __m128d r = _mm_mul_pd(g, _mm_loadu_pd(inputR + s));
+    g = _mm_mul_pd(g, gStep);
+    _mm_storeu_pd(outputL + s, l);
+    _mm_storeu_pd(outputR + s, r);
+    const __m128d l2 = _mm_mul_pd(l, l);
+    const __m128d r2 = _mm_mul_pd(r, r);
+    vPeakL = _mm_max_pd(vPeakL, _mm_and_pd(l, absMask));
+    vPeakR = _mm_max_pd(vPeakR, _mm_and_pd(r, absMask));
+    vSumSquaresL = _mm_add_pd(vSumSquaresL, l2);
+    vSumSquaresR = _mm_add_pd(vSumSquaresR, r2);
+    switch (link)
+    {
+      case stereo_noise_gate::Link::Off:
+        _mm_storeu_pd(detectorL + s, l2);
+        _mm_storeu_pd(detectorR + s, r2);
+        break;
+      case stereo_noise_gate::Link::Max: _mm_storeu_pd(detectorL + s, _mm_max_pd(l2, r2)); break;
+      case stereo_noise_gate::Link::Mid:
+      {
+        const __m128d m = _mm_mul_pd(half, _mm_add_pd(l, r));
+        _mm_storeu_pd(detectorL + s, _mm_mul_pd(m, m));
+        break;
+      }
+    }
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, g);
+  frameGain = lanes[0];
+  _mm_storeu_pd(lanes, vPeakL);
+  peakL = std::max(lanes[0], lanes[1]);
+  _mm_storeu_pd(lanes, vPeakR);
+  peakR = std::max(lanes[0], lanes[1]);
+  _mm_storeu_pd(lanes, vSumSquaresL);
+  sumSquaresL = lanes[0] + lanes[1];
+  _mm_storeu_pd(lanes, vSumSquaresR);
+  sumSquaresR = lanes[0] + lanes[1];
+#endif
+  for (; s < numFrames; s++)
+  {
+    const double l = frameGain * inputL[s];
+    const double r = frameGain * inputR[s];
+    frameGain *= gainRatio;
+    outputL[s] = l;
+    outputR[s] = r;
+    peakL = std::max(peakL, std::abs(l));
+    peakR = std::max(peakR, std::abs(r));
+    sumSquaresL += l * l;
+    sumSquaresR += r * r;
+    switch (link)
+    {
+      case stereo_noise_gate::Link::Off:
+        detectorL[s] = l * l;
+        detectorR[s] = r * r;
+        break;
+      case stereo_noise_gate::Link::Max: detectorL[s] = std::max(l * l, r * r); break;
+      case stereo_noise_gate::Link::Mid:
+      {
+        const double m = 0.5 * (l + r);
+        detectorL[s] = m * m;
+        break;
+      }
+    }
+  }
+  levels.peak = {peakL, peakR};
+  levels.sumSquares = {sumSquaresL, sumSquaresR};
+};
+}; // namespace input_stage
+}; // namespace dsp
@@ -0,0 +1,494 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "AudioDSPTools/dsp/dsp.h"
+#include "Convolution.h"
+#include "Spectral.h"
+
+namespace dsp
+{
+namespace light_cab
+{
+// One second-order section (a0 = 1)
+struct Biquad
+{
+  double b0 = 1.0;
+  double b1 = 0.0;
+  double b2 = 0.0;
+  double a1 = 0.0;
+  double a2 = 0.0;
+};
+
+// A cascade of biquads and a gain
+class Cascade
+{
+public:
+  Cascade() = default;
+  Cascade(std::vector<Biquad> sections, const double gain)
+  : mSections(std::move(sections))
+  , mState(mSections.size())
+  , mGain(gain) {};
+
+  void Reset()
+  {
+    for (auto& state : mState)
+      state = State();
+  };
+
+  // Transposed direct form II, so it's fine with poles close to the unit circle (in double precision).
+  double Process(double x)
+  {
+    for (size_t i = 0; i < mSections.size(); i++)
+    {
+      const Biquad& section = mSections[i];
+      State& state = mState[i];
+      const double y = section.b0 * x + state.s1;
+      state.s1 = section.b1 * x - section.a1 * y + state.s2;
+      state.s2 = section.b2 * x - section.a2 * y;
+      x = y;
+    }
+    return mGain * x;
+  };
+
+  // :param omega: Radians per sample
+  std::complex<double> GetResponse(const double omega) const
+  {
+    const std::complex<double> z1 = std::polar(1.0, -omega);
+    const std::complex<double> z2 = z1 * z1;
+    std::complex<double> response = mGain;
+    for (const auto& section : mSections)
+      response *= (section.b0 + section.b1 * z1 + section.b2 * z2) / (1.0 + section.a1 * z1 + section.a2 * z2);
+    return response;
+  };
+
+  const std::vector<Biquad>& GetSections() const { return mSections; };
+  double GetGain() const { return mGain; };
+
+private:
+  struct State
+  {
+    double s1 = 0.0;
+    double s2 = 0.0;
+  };
+  std::vector<Biquad> mSections;
+  std::vector<State> mState;
+  double mGain = 1.0;
+};
+
+// How close a fit is: its magnitude response minus the IR's, both smoothed to kSmoothingOctaves, in dB
+struct Report
+{
+  // Every kSmoothingOctaves from 20Hz up to 20kHz (or close to Nyquist)
+  std::vector<double> frequencies;
+  std::vector<double> errorDB;
+  double rmsErrorDB = 0.0;
+  double maxErrorDB = 0.0;
+  size_t order = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Report& report)
+{
+  os << "Light cab fit (order " << report.order << "): " << report.rmsErrorDB << " dB RMS error, "
+     << report.maxErrorDB << " dB at worst. By octave:";
+  // Every 6th is an octave apart.
+  for (size_t i = 0; i < report.frequencies.size(); i += 6)
+    os << " " << (int)std::round(report.frequencies[i]) << "Hz " << (report.errorDB[i] >= 0.0 ? "+" : "")
+       << std::round(10.0 * report.errorDB[i]) / 10.0 << "dB";
+  return os;
+};
+
+// The IR's magnitude response is smoothed over this many octaves before it's fit. Nobody hears the comb filtering
+// finer than that, and fitting it would waste poles.
+constexpr double kSmoothingOctaves = 1.0 / 6.0;
+constexpr size_t kDefaultOrder = 24;
+
+// For a bilinear warp that approximates the Bark scale at this sample rate (Smith & Abel). Fitting on a warped
+// frequency axis spends the poles where hearing is most sensitive instead of crowding them into the top octaves.
+inline double GetWarpingFactor(const double sampleRate)
+{
+  return 1.0674 * std::sqrt(2.0 / M_PI * std::atan(0.06583 * sampleRate / 1000.0)) - 0.1916;
+};
+
+// Roots of c[0] z^n + c[1] z^(n-1) + ... + c[n] (eigenvalues of the companion matrix). Leading coefficients that are
+// (nearly) 0 are roots at infinity, which come out as infinity.
+inline std::vector<std::complex<double>> FindRoots(const std::vector<double>& c)
+{
+  std::vector<std::complex<double>> roots;
+  double largest = 0.0;
+  for (const double x : c)
+    largest = std::max(largest, std::abs(x));
+  size_t first = 0;
+  while (first < c.size() && std::abs(c[first]) <= 1.0e-12 * largest)
+  {
+    if (first + 1 < c.size())
+      roots.push_back(std::numeric_limits<double>::infinity());
+    first++;
+  }
+  const int degree = (int)c.size() - 1 - (int)first;
+  if (degree <= 0)
+    return roots;
+  Eigen::MatrixXd companion = Eigen::MatrixXd::Zero(degree, degree);
+  for (int j = 0; j < degree; j++)
+    companion(0, j) = -c[first + 1 + j] / c[first];
+  for (int i = 1; i < degree; i++)
+    companion(i, i - 1) = 1.0;
+  Eigen::EigenSolver<Eigen::MatrixXd> solver(companion, false);
+  for (int i = 0; i < degree; i++)
+    roots.push_back(solver.eigenvalues()(i));
+  return roots;
+};
+
+namespace detail
+{
+// Roots grouped into real quadratics (1, c1, c2): conjugate pairs, then the real ones two at a time.
+struct Quadratic
+{
+  double c1 = 0.0;
+  double c2 = 0.0;
+  // One of its roots, for pairing poles with zeros, and how far out that is
+  std::complex<double> root = 0.0;
+  double radius = 0.0;
+};
+
+inline std::vector<Quadratic> MakeQuadratics(const std::vector<std::complex<double>>& roots)
+{
+  const double tolerance = 1.0e-9;
+  std::vector<Quadratic> quadratics;
+  std::vector<double> real;
+  for (const auto& r : roots)
+  {
+    if (std::abs(r.imag()) <= tolerance)
+      real.push_back(r.real());
+    else if (r.imag() > 0.0)
+    {
+      Quadratic q;
+      q.c1 = -2.0 * r.real();
+      q.c2 = std::norm(r);
+      q.root = r;
+      q.radius = std::abs(r);
+      quadratics.push_back(q);
+    }
+  }
+  std::sort(real.begin(), real.end());
+  for (size_t i = 0; i < real.size(); i += 2)
+  {
+    Quadratic q;
+    if (i + 1 < real.size())
+    {
+      q.c1 = -(real[i] + real[i + 1]);
+      q.c2 = real[i] * real[i + 1];
+      q.root = std::abs(real[i]) > std::abs(real[i + 1]) ? real[i] : real[i + 1];
+    }
+    else
+    {
+      q.c1 = -real[i];
+      q.root = real[i];
+    }
+    q.radius = std::abs(q.root);
+    quadratics.push_back(q);
+  }
+  return quadratics;
+};
+
+// Linear interpolation on an FFT's bins
+template <typename T>
+T Interpolate(const std::vector<T>& bins, const double omega, const size_t fftSize)
+{
+  const double position = std::clamp(omega / (2.0 * M_PI) * (double)fftSize, 0.0, (double)(bins.size() - 1));
+  const size_t i = std::min((size_t)position, bins.size() - 2);
+  const double frac = position - (double)i;
+  return bins[i] * (1.0 - frac) + bins[i + 1] * frac;
+};
+}; // namespace detail
+
+// Fits a pole-zero filter of the given order to an IR's (smoothed) magnitude response, with minimum phase.
+// Sanathanan-Koerner iterations (the frequency-domain take on Steiglitz-McBride) on a Bark-warped frequency axis,
+// relative to the target so that it's roughly the error in dB that's minimized. Poles that come out unstable are
+// reflected back inside the unit circle. Then it's unwarped into biquads.
+// Slow (for audio) and allocates; call it on a background thread.
+// :param order: Number of poles (and zeros); twice the number of biquads
+inline Cascade Fit(const std::vector<float>& ir, const double sampleRate, const size_t order, Report& report)
+{
+  report = Report();
+  report.order = order;
+  const size_t numSections = (order + 1) / 2;
+  const size_t n = 2 * numSections;
+  double irPeak = 0.0;
+  for (const float x : ir)
+    irPeak = std::max(irPeak, (double)std::abs(x));
+  if (irPeak == 0.0 || n == 0)
+    return Cascade({}, 0.0);
+
+  // The IR's spectrum...
+  const size_t fftSize = spectral::NextPowerOfTwo(std::max<size_t>(4 * ir.size(), 1 << 15));
+  spectral::RealFFT<double> fft(fftSize);
+  const size_t numBins = fft.GetNumBins();
+  std::vector<double> time(fftSize, 0.0);
+  std::copy(ir.begin(), ir.end(), time.begin());
+  std::vector<std::complex<double>> spectrum(numBins);
+  fft.Forward(time.data(), spectrum.data());
+
+  // ...its magnitude, smoothed (in power)...
+  std::vector<double> cumulative(numBins + 1, 0.0);
+  for (size_t k = 0; k < numBins; k++)
+    cumulative[k + 1] = cumulative[k] + std::norm(spectrum[k]);
+  const double halfBand = std::pow(2.0, 0.5 * kSmoothingOctaves);
+  std::vector<double> magnitude(numBins);
+  double peak = 0.0;
+  for (size_t k = 0; k < numBins; k++)
+  {
+    const size_t lo = (size_t)std::floor((double)k / halfBand);
+    const size_t hi = std::min(numBins - 1, (size_t)std::ceil((double)k * halfBand));
+    magnitude[k] = std::sqrt((cumulative[hi + 1] - cumulative[lo]) / (double)(hi - lo + 1));
+    peak = std::max(peak, magnitude[k]);
+  }
+  // (Nothing's worth fitting 120dB down.)
+  for (auto& m : magnitude)
+    m = std::max(m, peak * 1.0e-6);
+
+  // ...and the minimum-phase response with that magnitude (real cepstrum).
+  std::vector<std::complex<double>> logMagnitude(numBins);
+  for (size_t k = 0; k < numBins; k++)
+    logMagnitude[k] = std::log(magnitude[k]);
+  fft.Inverse(logMagnitude.data(), time.data());
+  for (size_t i = 1; i < fftSize / 2; i++)
+    time[i] *= 2.0;
+  std::fill(time.begin() + fftSize / 2 + 1, time.end(), 0.0);
+  fft.Forward(time.data(), spectrum.data());
+  std::vector<std::complex<double>> target(numBins);
+  for (size_t k = 0; k < numBins; k++)
+    target[k] = std::exp(spectrum[k]);
+
+  // Where to fit: evenly spaced on the warped axis. Above 20kHz (at high sample rates) matters much less.
+  const double lambda = GetWarpingFactor(sampleRate);
+  const size_t numPoints = std::max<size_t>(1024, 16 * n);
+  std::vector<double> warpedOmega(numPoints);
+  std::vector<std::complex<double>> h(numPoints);
+  std::vector<double> weight(numPoints);
+  for (size_t k = 0; k < numPoints; k++)
+  {
+    const double omegaW = M_PI * ((double)k + 0.5) / (double)numPoints;
+    const double omega = omegaW - 2.0 * std::atan(lambda * std::sin(omegaW) / (1.0 + lambda * std::cos(omegaW)));
+    warpedOmega[k] = omegaW;
+    h[k] = detail::Interpolate(target, omega, fftSize);
+    weight[k] = (omega * sampleRate / (2.0 * M_PI) <= 20000.0 ? 1.0 : 0.1) / std::abs(h[k]);
+  }
+  // e^(-j m omega) for m = 0..n at each point
+  Eigen::MatrixXcd powers(numPoints, n + 1);
+  for (size_t k = 0; k < numPoints; k++)
+    for (size_t m = 0; m <= n; m++)
+      powers(k, m) = std::polar(1.0, -(double)m * warpedOmega[k]);
+
+  // Sanathanan-Koerner: min |B - H A|^2 / |A_last|^2, which is linear in B and A.
+  const int numIterations = 20;
+  Eigen::VectorXd a = Eigen::VectorXd::Zero(n + 1);
+  a(0) = 1.0;
+  Eigen::MatrixXd system(2 * numPoints, 2 * n + 1);
+  Eigen::VectorXd rhs(2 * numPoints);
+  auto responseOf = [&](const Eigen::VectorXd& c, const size_t k) {
+    std::complex<double> sum = 0.0;
+    for (size_t m = 0; m < (size_t)c.size(); m++)
+      sum += c(m) * powers(k, m);
+    return sum;
+  };
+  for (int iteration = 0; iteration < numIterations; iteration++)
+  {
+    for (size_t k = 0; k < numPoints; k++)
+    {
+      const double w = weight[k] / std::max(std::abs(responseOf(a, k)), 1.0e-12);
+      for (size_t m = 0; m <= n; m++)
+      {
+        const std::complex<double> coefficient = w * powers(k, m);
+        system(2 * k, m) = coefficient.real();
+        system(2 * k + 1, m) = coefficient.imag();
+      }
+      for (size_t m = 1; m <= n; m++)
+      {
+        const std::complex<double> coefficient = -w * h[k] * powers(k, m);
+        system(2 * k, n + m) = coefficient.real();
+        system(2 * k + 1, n + m) = coefficient.imag();
+      }
+      rhs(2 * k) = w * h[k].real();
+      rhs(2 * k + 1) = w * h[k].imag();
+    }
+    const Eigen::VectorXd x = system.colPivHouseholderQr().solve(rhs);
+    a.tail(n) = x.tail(n);
+  }
+
+  // Keep the poles stable and a little way in from the unit circle.
+  const double maxRadius = 0.9999;
+  std::vector<double> aCoefficients(a.data(), a.data() + a.size());
+  std::vector<std::complex<double>> poles = FindRoots(aCoefficients);
+  for (auto& p : poles)
+  {
+    if (std::abs(p) > 1.0)
+      p = 1.0 / std::conj(p);
+    if (std::abs(p) > maxRadius)
+      p *= maxRadius / std::abs(p);
+  }
+  // A from the fixed poles, then B for it (linear).
+  std::vector<std::complex<double>> polynomial{1.0};
+  for (const auto& p : poles)
+  {
+    polynomial.push_back(0.0);
+    for (size_t m = polynomial.size() - 1; m > 0; m--)
+      polynomial[m] -= p * polynomial[m - 1];
+  }
+  for (size_t m = 0; m <= n; m++)
+    a(m) = m < polynomial.size() ? polynomial[m].real() : 0.0;
+  Eigen::MatrixXd numeratorSystem(2 * numPoints, n + 1);
+  for (size_t k = 0; k < numPoints; k++)
+  {
+    const std::complex<double> A = responseOf(a, k);
+    const double w = weight[k] / std::max(std::abs(A), 1.0e-12);
+    for (size_t m = 0; m <= n; m++)
+    {
+      const std::complex<double> coefficient = w * powers(k, m);
+      numeratorSystem(2 * k, m) = coefficient.real();
+      numeratorSystem(2 * k + 1, m) = coefficient.imag();
+    }
+    const std::complex<double> rightHandSide = w * h[k] * A;
+    rhs(2 * k) = rightHandSide.real();
+    rhs(2 * k + 1) = rightHandSide.imag();
+  }
+  const Eigen::VectorXd b = numeratorSystem.colPivHouseholderQr().solve(rhs);
+  std::vector<std::complex<double>> zeros = FindRoots(std::vector<double>(b.data(), b.data() + b.size()));
+
+  // Unwarp: a root r of the warped filter is (r + lambda) / (1 + lambda r) in the real one. (The (1 - lambda z^-1)^n
+  // that this leaves over each of B and A cancels.)
+  auto unwarp = [lambda](std::complex<double>& r) {
+    r = std::isinf(r.real()) ? std::complex<double>(1.0 / lambda) : (r + lambda) / (1.0 + lambda * r);
+  };
+  for (auto& p : poles)
+    unwarp(p);
+  for (auto& z : zeros)
+    unwarp(z);
+
+  // Biquads, most damped first, each with the zeros closest to its poles
+  std::vector<detail::Quadratic> poleQuadratics = detail::MakeQuadratics(poles);
+  std::vector<detail::Quadratic> zeroQuadratics = detail::MakeQuadratics(zeros);
+  std::sort(poleQuadratics.begin(), poleQuadratics.end(),
+            [](const detail::Quadratic& x, const detail::Quadratic& y) { return x.radius < y.radius; });
+  const size_t numQuadratics = std::max(poleQuadratics.size(), zeroQuadratics.size());
+  poleQuadratics.resize(numQuadratics);
+  std::vector<Biquad> sections(numQuadratics);
+  // The most resonant poles get first pick.
+  for (size_t i = numQuadratics; i-- > 0;)
+  {
+    Biquad& section = sections[i];
+    section.a1 = poleQuadratics[i].c1;
+    section.a2 = poleQuadratics[i].c2;
+    if (zeroQuadratics.empty())
+      continue;
+    size_t closest = 0;
+    for (size_t j = 1; j < zeroQuadratics.size(); j++)
+      if (std::abs(zeroQuadratics[j].root - poleQuadratics[i].root)
+          < std::abs(zeroQuadratics[closest].root - poleQuadratics[i].root))
+        closest = j;
+    section.b1 = zeroQuadratics[closest].c1;
+    section.b2 = zeroQuadratics[closest].c2;
+    zeroQuadratics.erase(zeroQuadratics.begin() + closest);
+  }
+
+  // The gain that makes the average error (in dB, over the audible band) 0
+  const Cascade unscaled(sections, 1.0);
+  const double maxFrequency = std::min(20000.0, 0.45 * sampleRate);
+  const double fineStep = std::pow(2.0, kSmoothingOctaves / 4.0);
+  double sumDB = 0.0;
+  size_t count = 0;
+  for (double f = 20.0; f <= maxFrequency; f *= fineStep, count++)
+  {
+    const double omega = 2.0 * M_PI * f / sampleRate;
+    sumDB += 20.0 * std::log10(detail::Interpolate(magnitude, omega, fftSize))
+             - 20.0 * std::log10(std::max(std::abs(unscaled.GetResponse(omega)), 1.0e-30));
+  }
+  const double gain = count > 0 ? std::pow(10.0, sumDB / (double)count / 20.0) : 1.0;
+  Cascade fitted(std::move(sections), gain);
+
+  const double step = std::pow(2.0, kSmoothingOctaves);
+  double sumSquares = 0.0;
+  for (double f = 20.0; f <= maxFrequency; f *= step)
+  {
+    const double omega = 2.0 * M_PI * f / sampleRate;
+    const double error = 20.0 * std::log10(std::max(std::abs(fitted.GetResponse(omega)), 1.0e-30))
+                         - 20.0 * std::log10(detail::Interpolate(magnitude, omega, fftSize));
+    report.frequencies.push_back(f);
+    report.errorDB.push_back(error);
+    sumSquares += error * error;
+    report.maxErrorDB = std::max(report.maxErrorDB, std::abs(error));
+  }
+  if (!report.errorDB.empty())
+    report.rmsErrorDB = std::sqrt(sumSquares / (double)report.errorDB.size());
+  return fitted;
+};
+
+// The IR (as ConvolutionIR would convolve it) approximated by a low-order IIR filter per channel. Next to nothing
+// to run, but it's only the magnitude response (smoothed, with minimum phase), and only as close as GetReports() say.
+class LightCab : public DSP
+{
+public:
+  // Fits it. Slow; don't call from the real-time loop.
+  LightCab(const ConvolutionIR::IRData& irData, const double sampleRate, const size_t order = kDefaultOrder)
+  : mSampleRate(sampleRate)
+  {
+    const std::vector<std::vector<float>> irs = ConvolutionIR::Resample(irData, sampleRate, mLayout);
+    std::vector<Cascade> fitted(irs.size());
+    mReports.resize(irs.size());
+    for (size_t k = 0; k < irs.size(); k++)
+      fitted[k] = Fit(irs[k], sampleRate, order, mReports[k]);
+    // Each input-output pair needs its own state, even when it's the same IR.
+    mRoutes.resize(mLayout.size());
+    for (size_t r = 0; r < mLayout.size(); r++)
+      if (mLayout[r] >= 0 && (size_t)mLayout[r] < fitted.size())
+        mRoutes[r] = fitted[mLayout[r]];
+      else
+        mLayout[r] = -1;
+  };
+
+  DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const size_t numChannels, const size_t numFrames) override
+  {
+    _PrepareBuffers(numChannels, numFrames);
+    const size_t numUsed = std::min(numChannels, kNumChannels);
+    for (size_t o = 0; o < numUsed; o++)
+    {
+      std::fill(mOutputs[o].begin(), mOutputs[o].begin() + numFrames, 0.0);
+      for (size_t i = 0; i < numUsed; i++)
+      {
+        const size_t r = o * kNumChannels + i;
+        if (mLayout[r] < 0)
+          continue;
+        Cascade& route = mRoutes[r];
+        for (size_t s = 0; s < numFrames; s++)
+          mOutputs[o][s] += route.Process(inputs[i][s]);
+      }
+    }
+    // More channels than we're set up for; copy the first one like ConvolutionIR does.
+    for (size_t c = numUsed; c < numChannels; c++)
+      std::copy(mOutputs[0].begin(), mOutputs[0].begin() + numFrames, mOutputs[c].begin());
+    return _GetPointers();
+  };
+
+  // One per IR channel that's used
+  const std::vector<Report>& GetReports() const { return mReports; };
+  double GetSampleRate() const { return mSampleRate; };
+
+private:
+  static constexpr size_t kNumChannels = 2;
+
+  double mSampleRate;
+  // [output * kNumChannels + input], like ConvolutionIR::Resample()
+  std::vector<int> mLayout;
+  std::vector<Cascade> mRoutes;
+  std::vector<Report> mReports;
+};
+}; // namespace light_cab
+}; // namespace dsp
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "AudioDSPTools/dsp/wav.h"
+
+namespace dsp
+{
+namespace wav
+{
+// A file mapped read-only into memory. Pages are read from disk as they're touched, not up front.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); };
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const char* fileName)
+  {
+    Close();
+#ifdef _WIN32
+    mFile = CreateFileA(
+      fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart <= 0)
+    {
+      Close();
+      return false;
+    }
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping == nullptr)
+    {
+      Close();
+      return false;
+    }
+    mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (mData == nullptr)
+    {
+      Close();
+      return false;
+    }
+    mSize = (size_t)size.QuadPart;
+#else
+    const int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+      close(fd);
+      return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open.
+    close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    // It'll be read front to back.
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    mData = static_cast<const uint8_t*>(data);
+    mSize = (size_t)st.st_size;
+#endif
+    return true;
+  };
+
+  void Close()
+  {
+#ifdef _WIN32
+    if (mData != nullptr)
+      UnmapViewOfFile(mData);
+    if (mMapping != nullptr)
+      CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+      CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if (mData != nullptr)
+      munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+    mData = nullptr;
+    mSize = 0;
+  };
+
+  const uint8_t* GetData() const { return mData; };
+  size_t GetSize() const { return mSize; };
+
+private:
+  const uint8_t* mData = nullptr;
+  size_t mSize = 0;
+#ifdef _WIN32
+  HANDLE mFile = INVALID_HANDLE_VALUE;
+  HANDLE mMapping = nullptr;
+#endif
+};
+
+enum class SampleFormat
+{
+  kInt16 = 0,
+  kInt24,
+  kInt32,
+  kFloat32,
+  kFloat64
+};
+
+inline size_t GetBytesPerSample(const SampleFormat format)
+{
+  switch (format)
+  {
+    case SampleFormat::kInt16: return 2;
+    case SampleFormat::kInt24: return 3;
+    case SampleFormat::kInt32:
+    case SampleFormat::kFloat32: return 4;
+    case SampleFormat::kFloat64: return 8;
+  }
+  return 0;
+};
+
+// One sample, little-endian and possibly unaligned like it is in the file, converted to [-1, 1).
+template <SampleFormat Format>
+inline float ConvertSample(const uint8_t* p)
+{
+  if constexpr (Format == SampleFormat::kInt16)
+    return (int16_t)(p[0] | (p[1] << 8)) / 32768.0f;
+  else if constexpr (Format == SampleFormat::kInt24)
+    return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0f;
+  else if constexpr (Format == SampleFormat::kInt32)
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24))
+           / 2147483648.0f;
+  else if constexpr (Format == SampleFormat::kFloat32)
+  {
+    float x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+  }
+  else
+  {
+    double x;
+    std::memcpy(&x, p, sizeof(x));
+    return (float)x;
+  }
+};
+
+// The interleaved samples of a WAV file, where they are in memory and what type they are. Doesn't own them.
+struct SampleView
+{
+  const uint8_t* data = nullptr;
+  SampleFormat format = SampleFormat::kInt16;
+  size_t numChannels = 0;
+  size_t numFrames = 0;
+
+  float Get(const size_t frame, const size_t channel) const
+  {
+    const uint8_t* p = data + (frame * numChannels + channel) * GetBytesPerSample(format);
+    switch (format)
+    {
+      case SampleFormat::kInt16: return ConvertSample<SampleFormat::kInt16>(p);
+      case SampleFormat::kInt24: return ConvertSample<SampleFormat::kInt24>(p);
+      case SampleFormat::kInt32: return ConvertSample<SampleFormat::kInt32>(p);
+      case SampleFormat::kFloat32: return ConvertSample<SampleFormat::kFloat32>(p);
+      case SampleFormat::kFloat64: return ConvertSample<SampleFormat::kFloat64>(p);
+    }
+    return 0.0f;
+  };
+
+  // Convert frames [start, start + count) to float, one output per channel (nullptr to skip a channel).
+  // Frames past the end come out as zeros.
+  void Read(const size_t start, const size_t count, float* const* outputs) const
+  {
+    switch (format)
+    {
+      case SampleFormat::kInt16: _Read<SampleFormat::kInt16>(start, count, outputs); break;
+      case SampleFormat::kInt24: _Read<SampleFormat::kInt24>(start, count, outputs); break;
+      case SampleFormat::kInt32: _Read<SampleFormat::kInt32>(start, count, outputs); break;
+      case SampleFormat::kFloat32: _Read<SampleFormat::kFloat32>(start, count, outputs); break;
+      case SampleFormat::kFloat64: _Read<SampleFormat::kFloat64>(start, count, outputs); break;
+    }
+  };
+
+private:
+  template <SampleFormat Format>
+  void _Read(const size_t start, const size_t count, float* const* outputs) const
+  {
+    const size_t bytesPerSample = GetBytesPerSample(Format);
+    const size_t available = std::min(count, numFrames - std::min(start, numFrames));
+    for (size_t c = 0; c < numChannels; c++)
+    {
+      float* output = outputs[c];
+      if (output == nullptr)
+        continue;
+      const uint8_t* p = data + (start * numChannels + c) * bytesPerSample;
+      const size_t stride = numChannels * bytesPerSample;
+      for (size_t i = 0; i < available; i++, p += stride)
+        output[i] = ConvertSample<Format>(p);
+      std::fill(output + available, output + count, 0.0f);
+    }
+  };
+};
+
+// A WAV file that's mapped into memory instead of read. Opening it only parses the header; the samples are converted
+// as they're read (see SampleView and StreamReader).
+class MappedWav
+{
+public:
+  LoadReturnCode Open(const char* fileName)
+  {
+    mView = SampleView();
+    mSampleRate = 0.0;
+    if (!mFile.Open(fileName))
+      return LoadReturnCode::ERROR_OPENING;
+    const uint8_t* data = mFile.GetData();
+    const size_t size = mFile.GetSize();
+    auto u16 = [data](const size_t i) { return (uint16_t)(data[i] | (data[i + 1] << 8)); };
+    auto u32 = [data](const size_t i) {
+      return (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) | ((uint32_t)data[i + 2] << 16)
+             | ((uint32_t)data[i + 3] << 24);
+    };
+    auto tagIs = [data](const size_t i, const char* tag) { return std::memcmp(data + i, tag, 4) == 0; };
+
+    if (size < 12 || !tagIs(0, "RIFF"))
+      return LoadReturnCode::ERROR_NOT_RIFF;
+    if (!tagIs(8, "WAVE"))
+      return LoadReturnCode::ERROR_NOT_WAVE;
+
+    const uint16_t kPCM = 1;
+    const uint16_t kIEEEFloat = 3;
+    const uint16_t kALaw = 6;
+    const uint16_t kMuLaw = 7;
+    const uint16_t kExtensible = 0xFFFE;
+    uint16_t format = 0;
+    uint16_t numChannels = 0;
+    uint16_t bitsPerSample = 0;
+    bool haveFormat = false;
+    size_t position = 12;
+    while (position + 8 <= size)
+    {
+      const size_t chunkSize = u32(position + 4);
+      const size_t body = position + 8;
+      if (tagIs(position, "fmt "))
+      {
+        if (chunkSize < 16 || body + chunkSize > size)
+          return LoadReturnCode::ERROR_INVALID_FILE;
+        format = u16(body);
+        numChannels = u16(body + 2);
+        mSampleRate = (double)u32(body + 4);
+        bitsPerSample = u16(body + 14);
+        // The sub-format GUID starts with the format code.
+        if (format == kExtensible && chunkSize >= 40)
+          format = u16(body + 24);
+        haveFormat = true;
+      }
+      else if (tagIs(position, "data"))
+      {
+        if (!haveFormat)
+          return LoadReturnCode::ERROR_MISSING_FMT;
+        if (format == kALaw)
+          return LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_ALAW;
+        if (format == kMuLaw)
+          return LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_MULAW;
+        if (format != kPCM && format != kIEEEFloat)
+          return LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_EXTENSIBLE;
+        if (format == kIEEEFloat && bitsPerSample == 32)
+          mView.format = SampleFormat::kFloat32;
+        else if (format == kIEEEFloat && bitsPerSample == 64)
+          mView.format = SampleFormat::kFloat64;
+        else if (format == kPCM && bitsPerSample == 16)
+          mView.format = SampleFormat::kInt16;
+        else if (format == kPCM && bitsPerSample == 24)
+          mView.format = SampleFormat::kInt24;
+        else if (format == kPCM && bitsPerSample == 32)
+          mView.format = SampleFormat::kInt32;
+        else
+          return LoadReturnCode::ERROR_UNSUPPORTED_BITS_PER_SAMPLE;
+        if (numChannels == 0 || mSampleRate <= 0.0)
+          return LoadReturnCode::ERROR_INVALID_FILE;
+        // Some writers leave the size of a streamed file's data chunk unset; take what's there.
+        const size_t dataSize = std::min(chunkSize, size - body);
+        mView.data = data + body;
+        mView.numChannels = numChannels;
+        mView.numFrames = dataSize / (numChannels * GetBytesPerSample(mView.format));
+        return LoadReturnCode::SUCCESS;
+      }
+      // Chunks are padded to an even size.
+      position = body + chunkSize + (chunkSize & 1);
+    }
+    return haveFormat ? LoadReturnCode::ERROR_INVALID_FILE : LoadReturnCode::ERROR_MISSING_FMT;
+  };
+
+  // Valid while this is open
+  const SampleView& GetView() const { return mView; };
+  size_t GetNumChannels() const { return mView.numChannels; };
+  size_t GetNumFrames() const { return mView.numFrames; };
+  double GetSampleRate() const { return mSampleRate; };
+
+private:
+  MappedFile mFile;
+  SampleView mView;
+  double mSampleRate = 0.0;
+};
+
+// Reads a MappedWav a block at a time as float, resampled if asked to, e.g. to render a long DI file through the
+// plugin's DSP offline. Nothing is read or copied up front, so it starts right away however long the file is.
+class StreamReader
+{
+public:
+  // :param outputSampleRate: What to resample to; 0 for the file's own rate
+  StreamReader(const MappedWav& wav, const double outputSampleRate = 0.0)
+  : mView(wav.GetView())
+  , mRatio(outputSampleRate > 0.0 ? wav.GetSampleRate() / outputSampleRate : 1.0)
+  {
+    mNumOutputFrames = mRatio == 1.0 ? mView.numFrames : (size_t)std::ceil((double)mView.numFrames / mRatio);
+  };
+
+  // How many frames Read() gives all together
+  size_t GetNumOutputFrames() const { return mNumOutputFrames; };
+  size_t GetPosition() const { return mPosition; };
+  bool IsDone() const { return mPosition >= mNumOutputFrames; };
+
+  // One output per channel of the file (nullptr to skip a channel).
+  // :return: How many frames were written; fewer than numFrames at the end of the file.
+  size_t Read(float* const* outputs, const size_t numFrames)
+  {
+    const size_t n = std::min(numFrames, mNumOutputFrames - mPosition);
+    if (mRatio == 1.0)
+      mView.Read(mPosition, n, outputs);
+    else
+    {
+      // Cubic (Catmull-Rom) interpolation, like dsp::ResampleCubic. Positions are computed from the start so that
+      // they don't drift over a long file.
+      for (size_t i = 0; i < n; i++)
+      {
+        const double x = (double)(mPosition + i) * mRatio;
+        const double i1 = std::floor(x);
+        const float t = (float)(x - i1);
+        for (size_t c = 0; c < mView.numChannels; c++)
+        {
+          if (outputs[c] == nullptr)
+            continue;
+          float p[4];
+          for (int k = 0; k < 4; k++)
+            p[k] = _Get((long long)i1 - 1 + k, c);
+          outputs[c][i] =
+            p[1]
+            + 0.5f * t
+                * (p[2] - p[0]
+                   + t * (2.0f * p[0] - 5.0f * p[1] + 4.0f * p[2] - p[3] + t * (3.0f * (p[1] - p[2]) + p[3] - p[0])));
+        }
+      }
+    }
+    mPosition += n;
+    return n;
+  };
+
+  void Seek(const size_t outputFrame) { mPosition = std::min(outputFrame, mNumOutputFrames); };
+
+private:
+  // Zeros outside of the file
+  float _Get(const long long frame, const size_t channel) const
+  {
+    return frame < 0 || (size_t)frame >= mView.numFrames ? 0.0f : mView.Get((size_t)frame, channel);
+  };
+
+  SampleView mView;
+  // Input frames per output frame
+  double mRatio;
+  size_t mNumOutputFrames = 0;
+  size_t mPosition = 0;
+};
+
+// Like Load(), but for files with any number of channels, and without reading the whole file into memory before
+// converting it.
+// :param audio: One vector per channel
+inline LoadReturnCode LoadMultichannel(const char* fileName, std::vector<std::vector<float>>& audio,
+                                       double& sampleRate)
+{
+  MappedWav wav;
+  const LoadReturnCode result = wav.Open(fileName);
+  if (result != LoadReturnCode::SUCCESS)
+    return result;
+  sampleRate = wav.GetSampleRate();
+  audio.assign(wav.GetNumChannels(), std::vector<float>(wav.GetNumFrames()));
+  // A chunk at a time so that the mapped pages are only walked once.
+  const size_t chunkSize = 1 << 14;
+  std::vector<float*> outputs(audio.size());
+  for (size_t start = 0; start < wav.GetNumFrames(); start += chunkSize)
+  {
+    const size_t n = std::min(chunkSize, wav.GetNumFrames() - start);
+    for (size_t c = 0; c < audio.size(); c++)
+      outputs[c] = audio[c].data() + start;
+    wav.GetView().Read(start, n, outputs.data());
+  }
+  return LoadReturnCode::SUCCESS;
+};
+}; // namespace wav
+}; // namespace dsp
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "Spectral.h"
+
+namespace dsp
+{
+namespace resampling
+{
+// Streams a signal from one sample rate to another with a polyphase FIR whose prototype lowpass has been made
+// minimum-phase. Compared to a linear-phase (e.g. Lanczos) resampler of the same length, the passband's phase isn't
+// linear anymore, but the delay drops from half the filter length to a few samples.
+template <typename T>
+class MinimumPhaseResampler
+{
+public:
+  // Design the filter and size the buffers.
+  // Allocates; don't call from the real-time loop.
+  // :param maxInputFrames: Most samples that will be given to one call to Process()
+  void Reset(const double inputSampleRate, const double outputSampleRate, const int maxInputFrames)
+  {
+    mStep = inputSampleRate / outputSampleRate;
+    // Lowpass at the lower of the two Nyquists, expressed relative to the input rate.
+    mCutoffScale = std::min(1.0, outputSampleRate / inputSampleRate);
+    _DesignTable();
+    mHistory.assign(mNumTaps + maxInputFrames + 2, (T)0);
+    // Start "full" of zeros so that the first output lines up with the first input.
+    mHistoryFill = mNumTaps - 1;
+    mTime = 0.0;
+  };
+
+  // Most samples that can come out of a call to Process() with numInputFrames in.
+  int GetMaxOutputFrames(const int numInputFrames) const { return (int)std::ceil(numInputFrames / mStep) + 1; };
+
+  // Delay of the filter at DC, in output samples.
+  double GetDelay() const { return mDelay / mStep; };
+
+  // :return: Number of output samples written
+  int Process(const T* input, const int numInputFrames, T* output, const int maxOutputFrames)
+  {
+    if (mHistoryFill + numInputFrames > (int)mHistory.size())
+      throw std::runtime_error("More frames were provided than the max expected!");
+    std::copy(input, input + numInputFrames, mHistory.begin() + mHistoryFill);
+    mHistoryFill += numInputFrames;
+
+    // mTime is relative to the oldest sample in mHistory that the newest output could still need.
+    const double scale = mCutoffScale * kPhases;
+    int numOutput = 0;
+    while (numOutput < maxOutputFrames)
+    {
+      const int i = (int)mTime + mNumTaps - 1; // Newest input that the output at mTime uses
+      if (i >= mHistoryFill)
+        break;
+      const double frac = mTime - std::floor(mTime);
+      double acc = 0.0;
+      const T* x = mHistory.data() + i;
+      for (int k = 0; k < mNumTaps; k++)
+      {
+        const double pos = (frac + k) * scale;
+        const int j = (int)pos;
+        const double a = pos - j;
+        acc += (double)x[-k] * (mTable[j] + a * (mTable[j + 1] - mTable[j]));
+      }
+      output[numOutput++] = (T)acc;
+      mTime += mStep;
+    }
+
+    // Drop what nobody needs anymore.
+    const int drop = std::min((int)mTime, mHistoryFill);
+    if (drop > 0)
+    {
+      std::copy(mHistory.begin() + drop, mHistory.begin() + mHistoryFill, mHistory.begin());
+      mHistoryFill -= drop;
+      mTime -= drop;
+    }
+    return numOutput;
+  };
+
+private:
+  // Half-length of the prototype, in zero crossings (input samples when not downsampling)
+  static constexpr int kZeroCrossings = 16;
+  // Table resolution, in phases per input sample
+  static constexpr int kPhases = 256;
+  // Prototype cutoff as a fraction of the Nyquist that we're filtering for
+  static constexpr double kCutoff = 0.9;
+  static constexpr double kKaiserBeta = 8.0;
+
+  void _DesignTable()
+  {
+    // Linear-phase windowed sinc, oversampled by kPhases, then made minimum-phase as one long filter.
+    const int length = 2 * kZeroCrossings * kPhases + 1;
+    const double center = 0.5 * (length - 1);
+    std::vector<double> h(length);
+    double sum = 0.0;
+    for (int j = 0; j < length; j++)
+    {
+      const double t = (j - center) / kPhases; // In prototype samples
+      const double x = kCutoff * t;
+      const double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+      const double r = (j - center) / center;
+      const double window = _BesselI0(kKaiserBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) / _BesselI0(kKaiserBeta);
+      h[j] = sinc * window;
+      sum += h[j];
+    }
+    spectral::MakeMinimumPhase(h);
+
+    // Enough taps to cover the (stretched) prototype. The table is zero-padded past the prototype so that the
+    // last tap's interpolation stays in bounds.
+    const double phasesPerTap = kPhases * mCutoffScale;
+    mNumTaps = (int)std::ceil(length / phasesPerTap);
+    mTable.assign((size_t)std::ceil((mNumTaps + 1) * phasesPerTap) + 2, 0.0);
+
+    // Unity gain at DC: the taps used for any one output sum to (about) sum / (kPhases * mCutoffScale) of the table.
+    const double gain = kPhases / sum;
+    double moment = 0.0;
+    double area = 0.0;
+    for (int j = 0; j < length; j++)
+    {
+      mTable[j] = gain * h[j];
+      moment += j * mTable[j];
+      area += mTable[j];
+    }
+    // Group delay at DC, converted from table phases to input samples.
+    mDelay = moment / area / phasesPerTap;
+    // Account for the scale when the kernel is stretched to filter at the output's Nyquist
+    for (auto& x : mTable)
+      x *= mCutoffScale;
+  };
+
+  static double _BesselI0(const double x)
+  {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++)
+    {
+      term *= (0.5 * x / k) * (0.5 * x / k);
+      sum += term;
+      if (term < 1.0e-12 * sum)
+        break;
+    }
+    return sum;
+  };
+
+  std::vector<double> mTable;
+  std::vector<T> mHistory;
+  int mHistoryFill = 0;
+  int mNumTaps = 0;
+  // Input samples per output sample
+  double mStep = 1.0;
+  double mCutoffScale = 1.0;
+  // Position of the next output, in input samples
+  double mTime = 0.0;
+  // In input samples
+  double mDelay = 0.0;
+};
+
+// Same interface as dsp::ResamplingContainer: runs a block-processing function at its own sample rate inside a host
+// that runs at another one. Uses minimum-phase filters for both directions.
+template <typename T>
+class MinimumPhaseResamplingContainer
+{
+public:
+  using BlockProcessFunc = std::function<void(T**, T**, int)>;
+
+  MinimumPhaseResamplingContainer(const double renderingSampleRate)
+  : mRenderingSampleRate(renderingSampleRate)
+  {
+  }
+
+  // Allocates; don't call from the real-time loop.
+  void Reset(const double sampleRate, const int maxBlockSize)
+  {
+    mUp.Reset(sampleRate, mRenderingSampleRate, maxBlockSize);
+    const int maxRenderingFrames = mUp.GetMaxOutputFrames(maxBlockSize);
+    mDown.Reset(mRenderingSampleRate, sampleRate, maxRenderingFrames);
+    mRenderingInput.assign(maxRenderingFrames, (T)0);
+    mRenderingOutput.assign(maxRenderingFrames, (T)0);
+
+    // How many rendering-rate samples come out of a block jitters by a sample, and so does how many host-rate
+    // samples come back. Buffer a couple of samples so that we never come up short.
+    mPadding = 2;
+    mOutput.assign(mPadding + mDown.GetMaxOutputFrames(maxRenderingFrames) + maxBlockSize, (T)0);
+    mOutputFill = mPadding;
+
+    const double ratio = sampleRate / mRenderingSampleRate;
+    const double delay = mUp.GetDelay() * ratio + mDown.GetDelay() + mPadding;
+    mDelay = delay;
+    mLatency = (int)std::lround(delay);
+  };
+
+  // Samples of delay at the host's rate (rounded).
+  int GetLatency() const { return mLatency; };
+  // Most frames that the block function will be asked to process at once.
+  int GetMaxRenderingBlockSize() const { return (int)mRenderingInput.size(); };
+  double GetDelay() const { return mDelay; };
+
+  void ProcessBlock(T** inputs, T** outputs, const int nFrames, BlockProcessFunc func)
+  {
+    const int numRendering = mUp.Process(inputs[0], nFrames, mRenderingInput.data(), (int)mRenderingInput.size());
+    T* renderingInput = mRenderingInput.data();
+    T* renderingOutput = mRenderingOutput.data();
+    if (numRendering > 0)
+      func(&renderingInput, &renderingOutput, numRendering);
+    mOutputFill += mDown.Process(
+      renderingOutput, numRendering, mOutput.data() + mOutputFill, (int)mOutput.size() - mOutputFill);
+
+    const int numOut = std::min(nFrames, mOutputFill);
+    std::copy(mOutput.begin(), mOutput.begin() + numOut, outputs[0]);
+    // Shouldn't happen, but better quiet than garbage.
+    std::fill(outputs[0] + numOut, outputs[0] + nFrames, (T)0);
+    std::copy(mOutput.begin() + numOut, mOutput.begin() + mOutputFill, mOutput.begin());
+    mOutputFill -= numOut;
+  };
+
+private:
+  double mRenderingSampleRate;
+  MinimumPhaseResampler<T> mUp;
+  MinimumPhaseResampler<T> mDown;
+  std::vector<T> mRenderingInput;
+  std::vector<T> mRenderingOutput;
+  std::vector<T> mOutput;
+  int mOutputFill = 0;
+  int mPadding = 0;
+  double mDelay = 0.0;
+  int mLatency = 0;
+};
+}; // namespace resampling
+}; // namespace dsp
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace dsp
+{
+// What a prewarmed model is good for: the file it came from (as of when it was last modified) and the settings it
+// was prewarmed for.
+struct ModelCacheKey
+{
+  std::string path;
+  std::filesystem::file_time_type modified;
+  double sampleRate = 0.0;
+  int maxBlockSize = 0;
+  bool minimumLatency = false;
+
+  bool operator==(const ModelCacheKey& other) const
+  {
+    return path == other.path && modified == other.modified && sampleRate == other.sampleRate
+           && maxBlockSize == other.maxBlockSize && minimumLatency == other.minimumLatency;
+  };
+};
+
+inline ModelCacheKey MakeModelCacheKey(const std::string& path, const double sampleRate, const int maxBlockSize,
+                                       const bool minimumLatency)
+{
+  ModelCacheKey key;
+  key.path = path;
+  std::error_code ec;
+  key.modified = std::filesystem::last_write_time(std::filesystem::u8path(path), ec);
+  key.sampleRate = sampleRate;
+  key.maxBlockSize = maxBlockSize;
+  key.minimumLatency = minimumLatency;
+  return key;
+};
+
+// Process-wide pool of models that have been loaded and prewarmed, but aren't being used by anyone.
+// Loading a model that's in here skips reading the file and prewarming it.
+// They may have been used since they were prewarmed, so prime what you take (ResamplingNAM::RestoreState()) before
+// it's heard; that replaces whatever it remembers. Each one is only good for one user at a time: taking it removes
+// it, so another instance loading the same model meanwhile loads its own.
+// Thread-safe, but takes a lock; don't use it from the audio thread.
+template <typename ModelType>
+class PrewarmedModelCache
+{
+public:
+  PrewarmedModelCache(const size_t maxSize = 4)
+  : mMaxSize(maxSize)
+  {
+  }
+
+  // :return: A prewarmed model for the key, or nullptr if there isn't one. It's yours now.
+  std::unique_ptr<ModelType> Take(const ModelCacheKey& key)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mEntries.begin(); it != mEntries.end(); ++it)
+    {
+      if (it->first == key)
+      {
+        std::unique_ptr<ModelType> model = std::move(it->second);
+        mEntries.erase(it);
+        return model;
+      }
+    }
+    return nullptr;
+  };
+
+  void Put(const ModelCacheKey& key, std::unique_ptr<ModelType> model)
+  {
+    if (model == nullptr || key.path.empty())
+      return;
+    std::unique_ptr<ModelType> evicted;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mEntries.emplace_front(key, std::move(model));
+      if (mEntries.size() > mMaxSize)
+      {
+        evicted = std::move(mEntries.back().second);
+        mEntries.pop_back();
+      }
+    }
+    // (evicted is freed out here, outside of the lock.)
+  };
+
+private:
+  std::mutex mMutex;
+  // Most recently put first
+  std::list<std::pair<ModelCacheKey, std::unique_ptr<ModelType>>> mEntries;
+  size_t mMaxSize;
+};
+}; // namespace dsp
@@ -1,4 +1,5 @@
 #include <algorithm> // std::clamp, std::min
+#include <chrono>
 #include <cmath> // pow
 #include <filesystem>
 #include <iostream>
@@ -21,6 +22,16 @@ using namespace iplug;
 using namespace igraphics;
 
 const double kDCBlockerFrequency = 5.0;
+// Input below this (about -160 dB) counts as silence...
+const double kSilenceThreshold = 1.0e-8;
+// ...and the chain's done ringing once it's decayed this much (dB).
+const double kTailDecayDB = 120.0;
+// How long the tone stack's knobs need to sit still before it's folded into the IR
+const std::chrono::milliseconds kFoldEQSettleTime(250);
+// How long it takes to crossfade between the live tone stack and the IR with it folded in (seconds)
+const double kFoldEQCrossfadeTime = 0.05;
+// How long it takes to crossfade between the IR and the light cab (seconds)
+const double kLightCabCrossfadeTime = 0.05;
 
 // Styles
 const IVColorSpec colorSpec{
@@ -69,6 +80,41 @@ EMsgBoxResult _ShowMessageBox(iplug::igraphics::IGraphics* pGraphics, const char
 #endif
 }
 
+// IR kernels that instances are using, so that others can share them
+dsp::IRCache& _GetIRCache()
+{
+  static dsp::IRCache cache;
+  return cache;
+}
+
+// How much longer an IR gets when the tone stack is folded into it: however long its impulse response is. Whatever the
+// knobs are set to, it's decayed by over 120dB after 40ms.
+size_t _GetFoldedEQLength(const double sampleRate)
+{
+  return (size_t)(0.04 * sampleRate);
+}
+
+// Prewarmed models that no instance is using right now
+dsp::PrewarmedModelCache<ResamplingNAM>& _GetModelCache()
+{
+  static dsp::PrewarmedModelCache<ResamplingNAM> cache;
+  return cache;
+}
+
+// The IR blend's parameters for each of the IR slot's files
+const int kIRBlendGainParams[kMaxIRBlendFiles] = {kIRGain, kIRBlend1Gain, kIRBlend2Gain};
+const int kIRBlendDelayParams[kMaxIRBlendFiles] = {kIRDelay, kIRBlend1Delay, kIRBlend2Delay};
+const int kIRBlendInvertParams[kMaxIRBlendFiles] = {kIRInvert, kIRBlend1Invert, kIRBlend2Invert};
+
+// E.g. "IRGain", "IRBlend1Gain"
+std::string _GetIRBlendParamName(const size_t file, const std::string& what)
+{
+  return (file == 0 ? std::string("IR") : "IRBlend" + std::to_string(file)) + what;
+}
+
+// Marks where the IR blend starts in the serialized state (see SerializeState())
+const std::string kIRBlendHeader = "###IRBlend###";
+
 const std::string kCalibrateInputParamName = "CalibrateInput";
 const bool kDefaultCalibrateInput = false;
 const std::string kInputCalibrationLevelParamName = "InputCalibrationLevel";
@@ -102,8 +148,20 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
   GetParam(kProcessingMode)->InitEnum("Mode", 0, {"Guitar", "Vocal"});
   GetParam(kABToggle)->InitEnum("Slot", 0, {"A", "B"});
   GetParam(kABMix)->InitDouble("A/B Mix", 0.0, 0.0, 1.0, 0.01);
-
-  mNoiseGateTrigger.AddListener(&mNoiseGateGain);
+  GetParam(kMinimumLatency)->InitBool("MinimumLatency", false);
+  GetParam(kIRTrim)->InitBool("IRTrim", false);
+  GetParam(kIRTrimThreshold)->InitDouble("IRTrimThreshold", -80.0, -120.0, -30.0, 1.0, "dB");
+  GetParam(kIRMinimumPhase)->InitBool("IRMinimumPhase", false);
+  GetParam(kFoldEQ)->InitBool("FoldEQ", false);
+  for (size_t i = 0; i < kMaxIRBlendFiles; i++)
+  {
+    GetParam(kIRBlendGainParams[i])->InitGain(_GetIRBlendParamName(i, "Gain").c_str(), 0.0, -40.0, 12.0, 0.1);
+    GetParam(kIRBlendDelayParams[i])
+      ->InitDouble(_GetIRBlendParamName(i, "Delay").c_str(), 0.0, 0.0, 10.0, 0.01, "ms");
+    GetParam(kIRBlendInvertParams[i])->InitBool(_GetIRBlendParamName(i, "Invert").c_str(), false);
+  }
+  GetParam(kLightCab)->InitBool("LightCab", false);
+  GetParam(kNoiseGateLink)->InitEnum("NoiseGateLink", 1, {"Off", "Max", "Mid"});
 
   mMakeGraphicsFunc = [&]() {
 
@@ -337,6 +395,8 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
 
 NeuralAmpModeler::~NeuralAmpModeler()
 {
+  // Don't let a rebuild finish into a half-destroyed plugin.
+  mWorker.Stop();
   _DeallocateIOPointers();
 }
 
@@ -349,8 +409,11 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
   const double sampleRate = GetSampleRate();
   
   // 获取A/B混合比例
-  const double abMix = GetParam(kABMix)->Value();
-  const bool useABMixing = abMix > 0.0 && abMix < 1.0 && mModelA && mModelB;
+  mABMix.SetTarget(GetParam(kABMix)->Value());
+  double abMix, abMixStep;
+  mABMix.Next(numFrames, abMix, abMixStep);
+  // Mixing if it's anywhere between A and B during the block
+  const bool useABMixing = !(abMixStep == 0.0 && (abMix <= 0.0 || abMix >= 1.0)) && mModelA && mModelB;
 
   // Disable floating point denormals
   std::fenv_t fe_state;
@@ -358,31 +421,56 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
   disable_denormals();
 
   _PrepareBuffers(numChannelsInternal, numFrames);
+  // The input pass works out the gate's detector signal for it.
+  mNoiseGate.SetLink((dsp::stereo_noise_gate::Link)GetParam(kNoiseGateLink)->Int());
   // 保留立体声信息
   _ProcessInput(inputs, numFrames, numChannelsExternalIn, numChannelsInternal);
   _ApplyDSPStaging();
+  if (!_LiveDSPCanProcess(sampleRate, nFrames))
+  {
+    // The model and IR for these settings are still being built (or couldn't be). Rather than risk running what's
+    // live with the wrong sample rate or too big a block, be quiet until they're ready.
+    for (size_t c = 0; c < numChannelsExternalOut; c++)
+      std::fill(outputs[c], outputs[c] + numFrames, 0.0);
+    std::feupdateenv(&fe_state);
+    return;
+  }
+  // Nothing's coming in, and everything that did has rung out, so there's nothing to do but be quiet.
+  const double inputPeak = std::max(mInputLevels.peak[0], mInputLevels.peak[1]);
+  const size_t tailSize = (size_t)std::max(GetTailSize(), 0);
+  mSilentFrames = inputPeak <= kSilenceThreshold ? std::min(mSilentFrames + numFrames, tailSize + numFrames) : 0;
+  if (mSilentFrames >= tailSize + numFrames && !useABMixing)
+  {
+    // The model's already heard its receptive field's worth of silence, so it can pick up where it is.
+    for (size_t c = 0; c < numChannelsInternal; c++)
+      mInputHistory[c].Write(mInputPointers[c], numFrames);
+    for (size_t c = 0; c < numChannelsInternal; c++)
+      std::fill(mOutputPointers[c], mOutputPointers[c] + numFrames, 0.0);
+    _ProcessOutput(mOutputPointers, outputs, numFrames, numChannelsExternalOut);
+    _UpdateInputMeter(numFrames);
+    std::feupdateenv(&fe_state);
+    return;
+  }
+
   const bool noiseGateActive = GetParam(kNoiseGateActive)->Value();
   const bool toneStackActive = GetParam(kEQActive)->Value();
 
-  // 噪声门处理（对每个通道单独处理）
+  // Noise gate: one detector for both channels unless it's unlinked
   sample** triggerOutputL = mInputPointers;
   sample** triggerOutputR = mInputPointers + 1;
   
   if (noiseGateActive)
   {
-    const double time = 0.01;
-    const double threshold = GetParam(kNoiseGateThreshold)->Value();
-    const double ratio = 0.1;
-    const double openTime = 0.005;
-    const double holdTime = 0.01;
-    const double closeTime = 0.05;
-    const dsp::noise_gate::TriggerParams triggerParams(time, threshold, ratio, openTime, holdTime, closeTime);
-    mNoiseGateTrigger.SetParams(triggerParams);
-    mNoiseGateTrigger.SetSampleRate(sampleRate);
-    
-    // 对左右声道分别处理
-    triggerOutputL = mNoiseGateTrigger.Process(mInputPointers, 1, numFrames);
-    triggerOutputR = mNoiseGateTrigger.Process(mInputPointers + 1, 1, numFrames);
+    dsp::stereo_noise_gate::Gate::Params gateParams;
+    gateParams.time = 0.01;
+    gateParams.threshold = GetParam(kNoiseGateThreshold)->Value();
+    gateParams.ratio = 0.1;
+    gateParams.openTime = 0.005;
+    gateParams.holdTime = 0.01;
+    gateParams.closeTime = 0.05;
+    mNoiseGate.SetParams(gateParams);
+    // Listens now (to what _ProcessInput() gave it), gates after the model. The signal goes through untouched.
+    mNoiseGate.DetectFromSignals(numChannelsInternal, numFrames);
   }
 
   // 为AB混合准备临时缓冲区
@@ -398,6 +486,10 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
     tempOutput2R.resize(numFrames);
   }
   
+  // Remember what the model hears so that the next one can start where it is.
+  for (size_t c = 0; c < numChannelsInternal; c++)
+    mInputHistory[c].Write(mInputPointers[c], numFrames);
+
   // 标准模型处理（当前槽位或槽位A）
   if (mModel != nullptr)
   {
@@ -427,14 +519,29 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
       }
       
       // 混合两个槽位的输出
-      for (size_t s = 0; s < numFrames; s++) {
-        mOutputArray[0][s] = tempOutputL[s] * (1.0 - abMix) + tempOutput2L[s] * abMix;
-        mOutputArray[1][s] = tempOutputR[s] * (1.0 - abMix) + tempOutput2R[s] * abMix;
+      double mix = abMix;
+      for (size_t s = 0; s < numFrames; s++, mix += abMixStep) {
+        mOutputArray[0][s] = tempOutputL[s] * (1.0 - mix) + tempOutput2L[s] * mix;
+        mOutputArray[1][s] = tempOutputR[s] * (1.0 - mix) + tempOutput2R[s] * mix;
       }
     } else {
       // 正常处理（无混合）
-      mModel->process(triggerOutputL[0], mOutputPointers[0], nFrames);
-      mModel->process(triggerOutputR[0], mOutputPointers[1], nFrames);
+      // Once the gate's been shut for longer than the model remembers, it only has silence to add, so don't run it.
+      // It catches up on what it missed when the gate opens again.
+      const bool skipModel =
+        noiseGateActive && mNoiseGate.GetClosedFrames() >= numFrames + (size_t)mModel->GetWakeLength();
+      if (skipModel)
+      {
+        mModel->Skip(triggerOutputL[0], nFrames);
+        mModel->Skip(triggerOutputR[0], nFrames);
+        for (size_t c = 0; c < numChannelsInternal; c++)
+          std::fill(mOutputPointers[c], mOutputPointers[c] + numFrames, 0.0);
+      }
+      else
+      {
+        mModel->process(triggerOutputL[0], mOutputPointers[0], nFrames);
+        mModel->process(triggerOutputR[0], mOutputPointers[1], nFrames);
+      }
     }
   }
   else
@@ -448,44 +555,18 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
   
   // 临时存储后处理前的输出
   sample** processingSignalL = &mOutputPointers[0];
-  sample** processingSignalR = &mOutputPointers[1];
   
   // 对左右声道分别应用噪声门
-  sample** gateGainOutputL = noiseGateActive ? mNoiseGateGain.Process(processingSignalL, 1, numFrames) : processingSignalL;
-  sample** gateGainOutputR = noiseGateActive ? mNoiseGateGain.Process(processingSignalR, 1, numFrames) : processingSignalR;
-
-  // 对左右声道分别应用音调控制
-  sample** toneStackOutPointersL = (toneStackActive && mToneStack != nullptr)
-                                    ? mToneStack->Process(gateGainOutputL, 1, numFrames)
-                                    : gateGainOutputL;
-  sample** toneStackOutPointersR = (toneStackActive && mToneStack != nullptr)
-                                    ? mToneStack->Process(gateGainOutputR, 1, numFrames)
-                                    : gateGainOutputR;
-
-  // 对左右声道分别应用IR
-  sample** irPointersL = toneStackOutPointersL;
-  sample** irPointersR = toneStackOutPointersR;
-  if (mIR != nullptr && GetParam(kIRToggle)->Value())
-  {
-    irPointersL = mIR->Process(toneStackOutPointersL, 1, numFrames);
-    irPointersR = mIR->Process(toneStackOutPointersR, 1, numFrames);
-  }
+  sample** gateGainOutputL =
+    noiseGateActive ? mNoiseGate.Apply(processingSignalL, numChannelsInternal, numFrames) : processingSignalL;
+  sample** gateGainOutputR = gateGainOutputL + 1;
 
-  // 对左右声道分别应用高通滤波器
-  const double highPassCutoffFreq = kDCBlockerFrequency;
-  const recursive_linear_filter::HighPassParams highPassParams(sampleRate, highPassCutoffFreq);
-  mHighPass.SetParams(highPassParams);
-  sample** hpfPointersL = mHighPass.Process(irPointersL, 1, numFrames);
-  sample** hpfPointersR = mHighPass.Process(irPointersR, 1, numFrames);
+  // 对左右声道分别应用IR和音调控制
+  sample** irPointersL = _ProcessIRAndToneStack(gateGainOutputL, toneStackActive, numFrames);
 
   // 还原左右声道的处理结果到输出缓冲区
-  if (!useABMixing) { // 如果使用了AB混合，上面已经设置了mOutputArray
-    for (size_t s = 0; s < numFrames; s++)
-    {
-      mOutputArray[0][s] = hpfPointersL[0][s];
-      mOutputArray[1][s] = hpfPointersR[0][s];
-    }
-  } else {
+  sample** outputSignal = irPointersL;
+  if (useABMixing) { // 如果使用了AB混合，上面已经设置了mOutputArray
     // 应用后处理效果到混合后的信号
     for (size_t s = 0; s < numFrames; s++)
     {
@@ -498,15 +579,16 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
       // 此处可以应用其他后处理效果
       // ...
     }
+    outputSignal = mOutputPointers;
   }
 
+  // Let's get outta here
+  // This is where we exit for whatever the output requires.
+  _ProcessOutput(outputSignal, outputs, numFrames, numChannelsExternalOut);
+  _UpdateInputMeter(numFrames);
+
   // restore previous floating point state
   std::feupdateenv(&fe_state);
-
-  // Let's get outta here
-  // This is where we exit mono for whatever the output requires.
-  _ProcessOutput(mOutputPointers, outputs, numFrames, numChannelsInternal, numChannelsExternalOut);
-  _UpdateMeters(mInputPointers, mOutputPointers, numFrames, numChannelsInternal, numChannelsInternal);
 }
 
 void NeuralAmpModeler::OnReset()
@@ -514,23 +596,36 @@ void NeuralAmpModeler::OnReset()
   const auto sampleRate = GetSampleRate();
   const int maxBlockSize = GetBlockSize();
 
-  // Tail is because the HPF DC blocker has a decay.
-  // 10 cycles should be enough to pass the VST3 tests checking tail behavior.
-  // I'm ignoring the model & IR, but it's not the end of the world.
-  const int tailCycles = 10;
-  SetTailSize(tailCycles * (int)(sampleRate / kDCBlockerFrequency));
   mInputSender.Reset(sampleRate);
   mOutputSender.Reset(sampleRate);
+  mOutputStage.SetSampleRate(sampleRate, kDCBlockerFrequency);
+  mOutputStage.Reset();
+  mNoiseGate.Reset(sampleRate, maxBlockSize);
+  mInputGain.Jump();
+  mOutputGain.Jump();
+  mABMix.SetTarget(GetParam(kABMix)->Value());
+  mABMix.Jump();
   // If there is a model or IR loaded, they need to be checked for resampling.
   _ResetModelAndIR(sampleRate, GetBlockSize());
   mToneStack->Reset(sampleRate, maxBlockSize);
+  // Its coefficient table for this sample rate (it gets by without until then)
+  mWorker.Submit([this, sampleRate]() { mToneStack->Prepare(sampleRate); });
   _UpdateLatency();
+  _UpdateTailSize();
+  mSilentFrames = 0;
 }
 
 void NeuralAmpModeler::OnIdle()
 {
   mInputSender.TransmitData(*this);
   mOutputSender.TransmitData(*this);
+  _UpdateSpectrum();
+  _UpdateIRInfo();
+
+  if (mHaveRetiredModel)
+    _CacheRetiredModel();
+  _UpdateFoldedEQ();
+  _UpdateLightCab();
 
   if (mNewModelLoadedInDSP)
   {
@@ -564,7 +659,24 @@ bool NeuralAmpModeler::SerializeState(IByteChunk& chunk) const
   // when we unserialize)
   chunk.PutStr(mNAMPath.Get());
   chunk.PutStr(mIRPath.Get());
-  return SerializeParams(chunk);
+  if (!SerializeParams(chunk))
+    return false;
+  // The IR blend goes after the params so that versions that don't know about it still read them. Its params are
+  // in there too so that it doesn't depend on which params a version reads.
+  chunk.PutStr(kIRBlendHeader.c_str());
+  const int numBlendFiles = (int)kMaxIRBlendFiles;
+  chunk.Put(&numBlendFiles);
+  for (size_t i = 0; i < kMaxIRBlendFiles; i++)
+  {
+    if (i > 0)
+      chunk.PutStr(mIRBlendPaths[i - 1].Get());
+    for (const int paramIdx : {kIRBlendGainParams[i], kIRBlendDelayParams[i], kIRBlendInvertParams[i]})
+    {
+      const double value = GetParam(paramIdx)->Value();
+      chunk.Put(&value);
+    }
+  }
+  return true;
 }
 
 int NeuralAmpModeler::UnserializeState(const IByteChunk& chunk, int startPos)
@@ -588,6 +700,8 @@ int NeuralAmpModeler::UnserializeState(const IByteChunk& chunk, int startPos)
 void NeuralAmpModeler::OnUIOpen()
 {
   Plugin::OnUIOpen();
+  // The settings page is new.
+  mIRInfoShown = false;
 
   if (mNAMPath.GetLength())
   {
@@ -623,9 +737,9 @@ void NeuralAmpModeler::OnParamChange(int paramIdx)
     case kOutputLevel:
     case kOutputMode: _SetOutputGain(); break;
     // Tone stack:
-    case kToneBass: mToneStack->SetParam("bass", GetParam(paramIdx)->Value()); break;
-    case kToneMid: mToneStack->SetParam("middle", GetParam(paramIdx)->Value()); break;
-    case kToneTreble: mToneStack->SetParam("treble", GetParam(paramIdx)->Value()); break;
+    case kToneBass: mToneStack->SetParam(dsp::tone_stack::kParamBass, GetParam(paramIdx)->Value()); break;
+    case kToneMid: mToneStack->SetParam(dsp::tone_stack::kParamMiddle, GetParam(paramIdx)->Value()); break;
+    case kToneTreble: mToneStack->SetParam(dsp::tone_stack::kParamTreble, GetParam(paramIdx)->Value()); break;
     case kProcessingMode:
     {
       const int modeIdx = GetParam(kProcessingMode)->Int();
@@ -639,6 +753,20 @@ void NeuralAmpModeler::OnParamChange(int paramIdx)
       _SwitchABSlot(useSlotB);
       break;
     }
+    // The resampler's filters are designed when the model is reset, so rebuild it.
+    case kMinimumLatency: _ResetModelAndIR(GetSampleRate(), GetBlockSize()); break;
+    case kIRTrim:
+    case kIRTrimThreshold:
+    case kIRMinimumPhase:
+    case kIRGain:
+    case kIRDelay:
+    case kIRInvert:
+    case kIRBlend1Gain:
+    case kIRBlend1Delay:
+    case kIRBlend1Invert:
+    case kIRBlend2Gain:
+    case kIRBlend2Delay:
+    case kIRBlend2Invert: _RebuildIR(); break;
     default: break;
   }
 }
@@ -665,8 +793,29 @@ bool NeuralAmpModeler::OnMessage(int msgTag, int ctrlTag, int dataSize, const vo
 {
   switch (msgTag)
   {
-    case kMsgTagClearModel: mShouldRemoveModel = true; return true;
-    case kMsgTagClearIR: mShouldRemoveIR = true; return true;
+    case kMsgTagClearModel:
+    {
+      std::lock_guard<std::mutex> lock(mStagingMutex);
+      mModelGeneration++;
+      mModelData = nullptr;
+      mShouldRemoveModel = true;
+      return true;
+    }
+    case kMsgTagClearIR:
+    {
+      std::lock_guard<std::mutex> lock(mStagingMutex);
+      mIRGeneration++;
+      mCachedIR = nullptr;
+      mShouldRemoveIR = true;
+      return true;
+    }
+    case kMsgTagSetIRBlendFile:
+    {
+      WDL_String path;
+      if (dataSize > 0)
+        path.Set((const char*)pData, dataSize);
+      return _StageIRBlendFile((size_t)ctrlTag, path) == dsp::wav::LoadReturnCode::SUCCESS;
+    }
     case kMsgTagHighlightColor:
     {
       mHighLightColor.Set((const char*)pData);
@@ -711,30 +860,42 @@ void NeuralAmpModeler::_AllocateIOPointers(const size_t nChans)
 
 void NeuralAmpModeler::_ApplyDSPStaging()
 {
-  // Remove marked modules
-  if (mShouldRemoveModel)
+  // If a loader is in the middle of staging something, then pick it up next block.
+  std::unique_lock<std::mutex> lock(mStagingMutex, std::try_to_lock);
+  if (!lock.owns_lock())
+    return;
+  // Remove marked modules. A model that's taken out of service waits in mRetiredModel for OnIdle() to cache it, so it
+  // isn't freed here; if the last one's still waiting, then this one waits for the next block.
+  if (mShouldRemoveModel && mRetiredModel == nullptr)
   {
-    mModel = nullptr;
+    _RetireModel();
     mNAMPath.Set("");
     mShouldRemoveModel = false;
     mModelCleared = true;
     _UpdateLatency();
+    _UpdateTailSize();
     _SetInputGain();
     _SetOutputGain();
   }
   if (mShouldRemoveIR)
   {
     mIR = nullptr;
+    _RetireFoldedEQ();
+    _RetireLightCab();
     mIRPath.Set("");
     mShouldRemoveIR = false;
+    _UpdateTailSize();
   }
   // Move things from staged to live
-  if (mStagedModel != nullptr)
+  if (mStagedModel != nullptr && mRetiredModel == nullptr)
   {
+    _RetireModel();
     mModel = std::move(mStagedModel);
     mStagedModel = nullptr;
+    mModelCacheKey = std::move(mStagedModelCacheKey);
     mNewModelLoadedInDSP = true;
     _UpdateLatency();
+    _UpdateTailSize();
     _SetInputGain();
     _SetOutputGain();
   }
@@ -742,9 +903,154 @@ void NeuralAmpModeler::_ApplyDSPStaging()
   {
     mIR = std::move(mStagedIR);
     mStagedIR = nullptr;
+    _RetireFoldedEQ();
+    _RetireLightCab();
+    _UpdateTailSize();
+  }
+  // Everything the latest rebuild made is live now (or it made nothing, and what's live is what there is).
+  if (mRebuildPending && mRebuildStagedGeneration == mRebuildGeneration && mStagedModel == nullptr)
+    mRebuildPending = false;
+  // The tone stack folded into the IR for new settings of its knobs. Swapped in while the filtered outputs aren't
+  // being heard, and once there's somewhere to put the old one.
+  if (mStagedFoldedEQ != nullptr && mFoldMix == 0.0 && mRetiredFoldedEQ == nullptr)
+  {
+    if (mIR != nullptr && mIR->GetDataPointer() == mStagedFoldedEQ->data.get()
+        && mIR->GetSampleRate() == mStagedFoldedEQ->sampleRate && mIR->SetFilter(mStagedFoldedEQ->kernel))
+    {
+      mRetiredFoldedEQ = std::move(mFoldedEQ);
+      mFoldedEQ = std::move(mStagedFoldedEQ);
+    }
+    else
+    {
+      // It was made for an IR (or settings) that's been replaced since.
+      mRetiredFoldedEQ = std::move(mStagedFoldedEQ);
+      mFoldedEQDropped = true;
+    }
+    mStagedFoldedEQ = nullptr;
+  }
+  // Likewise a light cab, while it isn't being heard
+  if (mStagedLightCab != nullptr && mLightMix == 0.0 && mRetiredLightCab == nullptr)
+  {
+    if (mIR != nullptr && mIR->GetDataPointer() == mStagedLightCab->data.get()
+        && mIR->GetSampleRate() == mStagedLightCab->cab->GetSampleRate())
+    {
+      mRetiredLightCab = std::move(mLightCab);
+      mLightCab = std::move(mStagedLightCab);
+    }
+    else
+    {
+      mRetiredLightCab = std::move(mStagedLightCab);
+      mLightCabDropped = true;
+    }
+    mStagedLightCab = nullptr;
   }
 }
 
+void NeuralAmpModeler::_RetireFoldedEQ()
+{
+  // A new IR starts with its filtered outputs off.
+  mFoldMix = 0.0;
+  if (mFoldedEQ == nullptr)
+    return;
+  mFoldedEQDropped = true;
+  // If OnIdle() hasn't gotten to the last one yet, then this one's freed here.
+  if (mRetiredFoldedEQ == nullptr)
+    mRetiredFoldedEQ = std::move(mFoldedEQ);
+  mFoldedEQ = nullptr;
+}
+
+void NeuralAmpModeler::_RetireLightCab()
+{
+  // A new IR is heard as-is until it's been fit.
+  mLightMix = 0.0;
+  if (mLightCab == nullptr)
+    return;
+  mLightCabDropped = true;
+  if (mRetiredLightCab == nullptr)
+    mRetiredLightCab = std::move(mLightCab);
+  mLightCab = nullptr;
+}
+
+void NeuralAmpModeler::_RetireModel()
+{
+  // _ApplyDSPStaging() only gets here once the last one's been picked up, so nothing's freed on the audio thread.
+  mRetiredModel = std::move(mModel);
+  mRetiredModelCacheKey = std::move(mModelCacheKey);
+  mModel = nullptr;
+  mModelCacheKey = dsp::ModelCacheKey();
+  if (mRetiredModel != nullptr)
+    mHaveRetiredModel = true;
+}
+
+void NeuralAmpModeler::_CacheRetiredModel()
+{
+  // std::function needs to be copyable, so share the (unique) model with the job.
+  auto retired = std::make_shared<std::unique_ptr<ResamplingNAM>>();
+  dsp::ModelCacheKey key;
+  {
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    *retired = std::move(mRetiredModel);
+    key = std::move(mRetiredModelCacheKey);
+    mHaveRetiredModel = false;
+  }
+  if (*retired == nullptr || key.path.empty())
+    return;
+  // No need to prewarm it again: whoever takes it primes it with what they've been hearing (see _PrimeModel()),
+  // which replaces whatever it remembers. (On the worker so that whatever it evicts isn't freed here.)
+  mWorker.Submit([retired, key]() { _GetModelCache().Put(key, std::move(*retired)); });
+}
+
+void NeuralAmpModeler::_PrimeModel(ResamplingNAM& model)
+{
+  // If the sample rate just changed, then some of this was heard at the old one. It only needs to get the model
+  // close to where the live one is.
+  ResamplingNAM::State state;
+  model.PrepareState(state);
+  // The live model hears each block's left channel and then its right one, so replay their histories the same way:
+  // alternating blocks (as big as the host said they'd be), ending with the right's. RestoreState() replays blocks of
+  // that size that end where the history does, so counting back from the newest, they go right, left, right, ...
+  const size_t size = state.history.size();
+  const size_t blockSize = (size_t)std::max(model.GetMaxBlockSize(), 1);
+  auto GetChannel = [](const size_t blocksBack) {
+    return kNumChannelsInternal - 1 - blocksBack % kNumChannelsInternal;
+  };
+  std::array<size_t, kNumChannelsInternal> lengths = {};
+  for (size_t end = size, blocksBack = 0; end > 0; blocksBack++)
+  {
+    const size_t n = std::min(end, blockSize);
+    lengths[GetChannel(blocksBack)] += n;
+    end -= n;
+  }
+  std::array<std::vector<sample>, kNumChannelsInternal> histories;
+  for (size_t c = 0; c < kNumChannelsInternal; c++)
+    histories[c].resize(lengths[c]);
+  // The audio thread only laps us if reading takes longer than the ring is (about a second), but don't spin on it.
+  // (It might get a block further along on one channel than the other while we read them, which is close enough.)
+  const int maxAttempts = 3;
+  for (int attempt = 0; attempt < maxAttempts; attempt++)
+  {
+    bool read = true;
+    for (size_t c = 0; c < kNumChannelsInternal; c++)
+      read = read && mInputHistory[c].ReadLatest(histories[c].data(), histories[c].size());
+    if (!read)
+      continue;
+    std::array<size_t, kNumChannelsInternal> remaining = lengths;
+    for (size_t end = size, blocksBack = 0; end > 0; blocksBack++)
+    {
+      const size_t c = GetChannel(blocksBack);
+      const size_t n = std::min(end, blockSize);
+      std::copy(histories[c].begin() + (remaining[c] - n), histories[c].begin() + remaining[c],
+                state.history.begin() + (end - n));
+      remaining[c] -= n;
+      end -= n;
+    }
+    model.RestoreState(state);
+    return;
+  }
+  // Silence then, like prewarming (the model might not be fresh; see PrewarmedModelCache).
+  model.RestoreState(state);
+}
+
 void NeuralAmpModeler::_DeallocateIOPointers()
 {
   if (mInputPointers != nullptr)
@@ -771,37 +1077,102 @@ void NeuralAmpModeler::_FallbackDSP(iplug::sample** inputs, iplug::sample** outp
       mOutputArray[c][s] = mInputArray[c][s];
 }
 
+bool NeuralAmpModeler::_LiveDSPCanProcess(const double sampleRate, const int numFrames) const
+{
+  const bool modelOk = mModel == nullptr || mModel->CanProcess(sampleRate, numFrames);
+  const bool irOk = mIR == nullptr || mIR->CanProcess(sampleRate, numFrames);
+  return modelOk && irOk;
+}
+
 void NeuralAmpModeler::_ResetModelAndIR(const double sampleRate, const int maxBlockSize)
 {
-  // Model
-  if (mStagedModel != nullptr)
-  {
-    mStagedModel->Reset(sampleRate, maxBlockSize);
-  }
-  else if (mModel != nullptr)
-  {
-    mModel->Reset(sampleRate, maxBlockSize);
-  }
+  // Rebuilding and prewarming the model and resampling the IR can take a while, and with a lot of instances open
+  // that hangs the session. So build fresh ones on the worker and stage them when they're ready. The audio thread
+  // keeps using what's live in the meantime (or stays quiet if that can't run with the new settings).
+  // They're built from what was loaded, not the files, which might have been moved or deleted since.
+  const std::string namPath(mNAMPath.Get());
+  const std::string irPath(mIRPath.Get());
+  if (namPath.empty() && irPath.empty())
+    return;
 
-  // IR
-  if (mStagedIR != nullptr)
-  {
-    const double irSampleRate = mStagedIR->GetSampleRate();
-    if (irSampleRate != sampleRate)
+  const bool minimumLatency = GetParam(kMinimumLatency)->Bool();
+  const uint64_t modelGeneration = mModelGeneration;
+  const uint64_t irGeneration = mIRGeneration;
+  const uint64_t rebuildGeneration = ++mRebuildGeneration;
+  mRebuildPending = true;
+
+  mWorker.Submit([this, sampleRate, maxBlockSize, namPath, irPath, minimumLatency, modelGeneration, irGeneration,
+                  rebuildGeneration]() {
+    std::unique_ptr<ResamplingNAM> model;
+    dsp::ModelCacheKey modelCacheKey;
+    std::unique_ptr<dsp::ConvolutionIR> ir;
+    // What ir is made from. Staged with it, which keeps it in the IR cache for other instances at these settings.
+    std::shared_ptr<const dsp::CachedIR> cachedIR;
+    try
     {
-      const auto irData = mStagedIR->GetData();
-      mStagedIR = std::make_unique<dsp::ImpulseResponse>(irData, sampleRate);
+      std::shared_ptr<const nam::dspData> modelData;
+      {
+        std::lock_guard<std::mutex> lock(mStagingMutex);
+        modelData = mModelData;
+      }
+      if (!namPath.empty() && modelData != nullptr)
+      {
+        modelCacheKey = dsp::MakeModelCacheKey(namPath, sampleRate, maxBlockSize, minimumLatency);
+        model = _GetModelCache().Take(modelCacheKey);
+        if (model == nullptr)
+        {
+          nam::dspData config = *modelData;
+          model = std::make_unique<ResamplingNAM>(nam::get_dsp(config), sampleRate, minimumLatency);
+          model->SetModelData(modelData);
+          model->Reset(sampleRate, maxBlockSize);
+        }
+        // (On mWorker: this replays the whole history through the model.)
+        _PrimeModel(*model);
+      }
     }
-  }
-  else if (mIR != nullptr)
-  {
-    const double irSampleRate = mIR->GetSampleRate();
-    if (irSampleRate != sampleRate)
+    catch (std::runtime_error& e)
     {
-      const auto irData = mIR->GetData();
-      mStagedIR = std::make_unique<dsp::ImpulseResponse>(irData, sampleRate);
+      model = nullptr;
+      std::cerr << "Failed to rebuild DSP module" << std::endl;
+      std::cerr << e.what() << std::endl;
     }
-  }
+    try
+    {
+      // Whatever's been staged most recently. (Not when this was submitted: a _RebuildIR() that was submitted before
+      // this might have replaced it since.)
+      {
+        std::lock_guard<std::mutex> lock(mStagingMutex);
+        cachedIR = mCachedIR;
+      }
+      if (!irPath.empty() && cachedIR != nullptr)
+      {
+        cachedIR = _GetIRCache().GetForSettings(*cachedIR, sampleRate, maxBlockSize, _GetFoldedEQLength(sampleRate));
+        ir = std::make_unique<dsp::ConvolutionIR>(cachedIR->data, cachedIR->kernel, sampleRate, maxBlockSize);
+      }
+    }
+    catch (std::runtime_error& e)
+    {
+      ir = nullptr;
+      cachedIR = nullptr;
+      std::cerr << "Failed to rebuild IR" << std::endl;
+      std::cerr << e.what() << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    // Only stage what hasn't been replaced or cleared since we started.
+    if (model != nullptr && modelGeneration == mModelGeneration)
+    {
+      mStagedModel = std::move(model);
+      mStagedModelCacheKey = std::move(modelCacheKey);
+    }
+    if (ir != nullptr && irGeneration == mIRGeneration)
+    {
+      mStagedIR = std::move(ir);
+      mCachedIR = std::move(cachedIR);
+    }
+    // _ApplyDSPStaging() clears mRebuildPending once it's swapped these in.
+    mRebuildStagedGeneration = std::max<uint64_t>(mRebuildStagedGeneration, rebuildGeneration);
+  });
 }
 
 void NeuralAmpModeler::_SetInputGain()
@@ -812,7 +1183,7 @@ void NeuralAmpModeler::_SetInputGain()
   {
     inputGainDB += GetParam(kInputCalibrationLevel)->Value() - mModel->GetInputLevel();
   }
-  mInputGain = DBToAmp(inputGainDB);
+  mInputGain.SetTarget(DBToAmp(inputGainDB));
 }
 
 void NeuralAmpModeler::_SetOutputGain()
@@ -843,7 +1214,7 @@ void NeuralAmpModeler::_SetOutputGain()
       default: break;
     }
   }
-  mOutputGain = DBToAmp(gainDB);
+  mOutputGain.SetTarget(DBToAmp(gainDB));
 }
 
 std::string NeuralAmpModeler::_StageModel(const WDL_String& modelPath)
@@ -851,11 +1222,30 @@ std::string NeuralAmpModeler::_StageModel(const WDL_String& modelPath)
   WDL_String previousNAMPath = mNAMPath;
   try
   {
-    auto dspPath = std::filesystem::u8path(modelPath.Get());
-    std::unique_ptr<nam::DSP> model = nam::get_dsp(dspPath);
-    std::unique_ptr<ResamplingNAM> temp = std::make_unique<ResamplingNAM>(std::move(model), GetSampleRate());
-    temp->Reset(GetSampleRate(), GetBlockSize());
-    mStagedModel = std::move(temp);
+    const bool minimumLatency = GetParam(kMinimumLatency)->Bool();
+    dsp::ModelCacheKey key = dsp::MakeModelCacheKey(modelPath.Get(), GetSampleRate(), GetBlockSize(), minimumLatency);
+    // If someone had this loaded recently, then it's loaded and prewarmed already (and primed below either way).
+    std::unique_ptr<ResamplingNAM> temp = _GetModelCache().Take(key);
+    if (temp == nullptr)
+    {
+      auto dspPath = std::filesystem::u8path(modelPath.Get());
+      auto modelData = std::make_shared<nam::dspData>();
+      std::unique_ptr<nam::DSP> model = nam::get_dsp(dspPath, *modelData);
+      temp = std::make_unique<ResamplingNAM>(std::move(model), GetSampleRate(), minimumLatency);
+      temp->SetModelData(std::move(modelData));
+      // (Only prewarms if the constructor's prewarm doesn't cover this block size.)
+      temp->Reset(GetSampleRate(), GetBlockSize());
+    }
+    // (Loading is never on the audio thread, and this replays the whole history through the model.)
+    _PrimeModel(*temp);
+    std::shared_ptr<const nam::dspData> modelData = temp->GetModelData();
+    {
+      std::lock_guard<std::mutex> lock(mStagingMutex);
+      mModelGeneration++;
+      mStagedModel = std::move(temp);
+      mStagedModelCacheKey = std::move(key);
+      mModelData = std::move(modelData);
+    }
     mNAMPath = modelPath;
     SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadedModel, mNAMPath.GetLength(), mNAMPath.Get());
   }
@@ -863,10 +1253,6 @@ std::string NeuralAmpModeler::_StageModel(const WDL_String& modelPath)
   {
     SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadFailed);
 
-    if (mStagedModel != nullptr)
-    {
-      mStagedModel = nullptr;
-    }
     mNAMPath = previousNAMPath;
     std::cerr << "Failed to read DSP module" << std::endl;
     std::cerr << e.what() << std::endl;
@@ -882,11 +1268,14 @@ dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIR(const WDL_String& irPath)
   WDL_String previousIRPath = mIRPath;
   const double sampleRate = GetSampleRate();
   dsp::wav::LoadReturnCode wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
+  std::unique_ptr<dsp::ConvolutionIR> ir;
+  std::shared_ptr<const dsp::CachedIR> cachedIR;
   try
   {
-    auto irPathU8 = std::filesystem::u8path(irPath.Get());
-    mStagedIR = std::make_unique<dsp::ImpulseResponse>(irPathU8.string().c_str(), sampleRate);
-    wavState = mStagedIR->GetWavState();
+    cachedIR = _LoadIR(
+      _GetIRBlendFiles(irPath.Get()), _GetIRPreprocessingOptions(), sampleRate, GetBlockSize(), wavState);
+    if (cachedIR != nullptr)
+      ir = std::make_unique<dsp::ConvolutionIR>(cachedIR->data, cachedIR->kernel, sampleRate, GetBlockSize());
   }
   catch (std::runtime_error& e)
   {
@@ -897,15 +1286,17 @@ dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIR(const WDL_String& irPath)
 
   if (wavState == dsp::wav::LoadReturnCode::SUCCESS)
   {
+    {
+      std::lock_guard<std::mutex> lock(mStagingMutex);
+      mIRGeneration++;
+      mStagedIR = std::move(ir);
+      mCachedIR = std::move(cachedIR);
+    }
     mIRPath = irPath;
     SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadedIR, mIRPath.GetLength(), mIRPath.Get());
   }
   else
   {
-    if (mStagedIR != nullptr)
-    {
-      mStagedIR = nullptr;
-    }
     mIRPath = previousIRPath;
     SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadFailed);
   }
@@ -913,6 +1304,327 @@ dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIR(const WDL_String& irPath)
   return wavState;
 }
 
+dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIRBlendFile(const size_t index, const WDL_String& path)
+{
+  if (index >= mIRBlendPaths.size())
+    return dsp::wav::LoadReturnCode::ERROR_OTHER;
+  if (path.GetLength() > 0)
+  {
+    // Find out now whether it can be read; the blending happens in the background.
+    dsp::wav::MappedWav wav;
+    const dsp::wav::LoadReturnCode wavState = wav.Open(std::filesystem::u8path(path.Get()).string().c_str());
+    if (wavState != dsp::wav::LoadReturnCode::SUCCESS)
+      return wavState;
+  }
+  mIRBlendPaths[index] = path;
+  _RebuildIR();
+  return dsp::wav::LoadReturnCode::SUCCESS;
+}
+
+dsp::ir_preprocessing::Options NeuralAmpModeler::_GetIRPreprocessingOptions() const
+{
+  dsp::ir_preprocessing::Options options;
+  options.trim = GetParam(kIRTrim)->Bool();
+  options.thresholdDB = GetParam(kIRTrimThreshold)->Value();
+  options.minimumPhase = GetParam(kIRMinimumPhase)->Bool();
+  return options;
+}
+
+std::vector<dsp::ir_blend::File> NeuralAmpModeler::_GetIRBlendFiles(const std::string& mainPath) const
+{
+  std::vector<dsp::ir_blend::File> files;
+  for (size_t i = 0; i < kMaxIRBlendFiles; i++)
+  {
+    dsp::ir_blend::File file;
+    file.path = i == 0 ? mainPath : std::string(mIRBlendPaths[i - 1].Get());
+    if (file.path.empty())
+      continue;
+    file.layer.gainDB = GetParam(kIRBlendGainParams[i])->Value();
+    file.layer.delayMs = GetParam(kIRBlendDelayParams[i])->Value();
+    file.layer.invert = GetParam(kIRBlendInvertParams[i])->Bool();
+    files.push_back(std::move(file));
+  }
+  return files;
+}
+
+std::shared_ptr<const dsp::CachedIR> NeuralAmpModeler::_LoadIR(const std::vector<dsp::ir_blend::File>& files,
+                                                                const dsp::ir_preprocessing::Options& options,
+                                                                const double sampleRate, const int maxBlockSize,
+                                                                dsp::wav::LoadReturnCode& wavState)
+{
+  if (files.empty())
+  {
+    wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
+    return nullptr;
+  }
+  const size_t foldedEQLength = _GetFoldedEQLength(sampleRate);
+  const dsp::IRCacheKey key = dsp::MakeIRCacheKey(files, options, sampleRate, maxBlockSize, foldedEQLength);
+  // If it's cached, then it was read fine.
+  wavState = dsp::wav::LoadReturnCode::SUCCESS;
+  return _GetIRCache().GetOrMake(key, [&]() -> std::shared_ptr<const dsp::CachedIR> {
+    // Blended into one IR (at the first one's sample rate), so the audio thread only ever does one convolution.
+    auto irData = std::make_shared<dsp::ConvolutionIR::IRData>();
+    for (const auto& file : files)
+    {
+      std::vector<std::vector<float>> channels;
+      double fileSampleRate = 0.0;
+      auto irPathU8 = std::filesystem::u8path(file.path);
+      wavState = dsp::wav::LoadMultichannel(irPathU8.string().c_str(), channels, fileSampleRate);
+      if (wavState != dsp::wav::LoadReturnCode::SUCCESS)
+      {
+        std::cerr << "Failed to load IR at " << file.path << std::endl;
+        return nullptr;
+      }
+      if (irData->mRawAudio.empty())
+        irData->mRawAudioSampleRate = fileSampleRate;
+      dsp::ir_blend::Add(channels, fileSampleRate, file.layer, irData->mRawAudioSampleRate, irData->mRawAudio);
+    }
+    auto cachedIR = std::make_shared<dsp::CachedIR>();
+    if (options.Any())
+      cachedIR->preprocessing = dsp::ir_preprocessing::Process(irData->mRawAudio, irData->mRawAudioSampleRate, options);
+    cachedIR->key = key;
+    cachedIR->kernel = dsp::ConvolutionIR::MakeKernel(*irData, sampleRate, maxBlockSize, foldedEQLength);
+    cachedIR->data = std::move(irData);
+    return cachedIR;
+  });
+}
+
+void NeuralAmpModeler::_RebuildIR()
+{
+  const std::string irPath(mIRPath.Get());
+  if (irPath.empty())
+    return;
+  const std::vector<dsp::ir_blend::File> files = _GetIRBlendFiles(irPath);
+  const dsp::ir_preprocessing::Options options = _GetIRPreprocessingOptions();
+  const double sampleRate = GetSampleRate();
+  const int maxBlockSize = GetBlockSize();
+  const uint64_t irGeneration = mIRGeneration;
+  const uint64_t rebuildGeneration = ++mIRRebuildGeneration;
+  mWorker.Submit([this, files, options, sampleRate, maxBlockSize, irGeneration, rebuildGeneration]() {
+    // Dragging a blend knob queues up a lot of these; only the last one matters.
+    if (rebuildGeneration != mIRRebuildGeneration)
+      return;
+    dsp::wav::LoadReturnCode wavState;
+    auto cachedIR = _LoadIR(files, options, sampleRate, maxBlockSize, wavState);
+    if (cachedIR == nullptr)
+      return;
+    auto ir = std::make_unique<dsp::ConvolutionIR>(cachedIR->data, cachedIR->kernel, sampleRate, maxBlockSize);
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    // Unless another IR was loaded or this one was cleared in the meantime
+    if (irGeneration == mIRGeneration)
+    {
+      mStagedIR = std::move(ir);
+      mCachedIR = std::move(cachedIR);
+    }
+  });
+}
+
+NeuralAmpModeler::ToneSettings NeuralAmpModeler::_GetToneSettings() const
+{
+  ToneSettings tone;
+  tone.bass = GetParam(kToneBass)->Value();
+  tone.middle = GetParam(kToneMid)->Value();
+  tone.treble = GetParam(kToneTreble)->Value();
+  for (int param = 0; param < dsp::tone_stack::kNumParams; param++)
+    tone.bands[param] = mToneStack->GetBand((dsp::tone_stack::Param)param);
+  return tone;
+}
+
+sample** NeuralAmpModeler::_ProcessIRAndToneStack(sample** inputs, const bool toneStackActive, const size_t numFrames)
+{
+  const size_t numChannels = kNumChannelsInternal;
+  const bool toneStack = toneStackActive && mToneStack != nullptr;
+  if (mIR == nullptr || !GetParam(kIRToggle)->Value())
+    return toneStack ? mToneStack->Process(inputs, numChannels, numFrames) : inputs;
+
+  // The light cab takes over once the tone stack's been faded back out of the IR (and until it's faded back out).
+  const bool light = GetParam(kLightCab)->Bool() && mLightCab != nullptr;
+  if ((light || mLightMix > 0.0) && mFoldMix == 0.0)
+    return _ProcessLightCab(inputs, light, toneStack, numFrames);
+
+  // Fold the tone stack in if the IR's filtered outputs were made for where its knobs are now.
+  const bool fold = toneStack && !light && GetParam(kFoldEQ)->Bool() && mFoldedEQ != nullptr
+                    && mFoldedEQ->tone == _GetToneSettings();
+  // Whatever's being heard or faded to needs to be computed. It can only fade once both have been for a whole block.
+  if (fold || mFoldMix > 0.0)
+    mIR->SetFilteredActive(true);
+  if (!fold || mFoldMix < 1.0)
+    mIR->SetUnfilteredActive(true);
+  const bool canFade = mIR->IsFilteredActive() && mIR->IsUnfilteredActive();
+
+  // Both channels in one call so that each gets its own convolver, and true-stereo IRs can feed left into right.
+  sample** irOutputs = mIR->Process(inputs, numChannels, numFrames);
+  sample** filteredOutputs = mIR->GetFilteredOutputs();
+
+  const double startMix = mFoldMix;
+  const double step =
+    canFade ? (fold ? 1.0 : -1.0) / std::max(kFoldEQCrossfadeTime * GetSampleRate(), 1.0) : 0.0;
+  mFoldMix = std::clamp(startMix + step * numFrames, 0.0, 1.0);
+  // Once it's all the way over, the other one doesn't need to be computed anymore.
+  if (fold && mFoldMix == 1.0)
+    mIR->SetUnfilteredActive(false);
+  if (!fold && mFoldMix == 0.0)
+    mIR->SetFilteredActive(false);
+
+  if (startMix == 1.0 && mFoldMix == 1.0)
+    return filteredOutputs;
+  sample** liveOutputs = toneStack ? mToneStack->Process(irOutputs, numChannels, numFrames) : irOutputs;
+  if (startMix == 0.0 && mFoldMix == 0.0)
+    return liveOutputs;
+  for (size_t c = 0; c < numChannels; c++)
+  {
+    double mix = startMix;
+    for (size_t s = 0; s < numFrames; s++)
+    {
+      mix = std::clamp(mix + step, 0.0, 1.0);
+      liveOutputs[c][s] += mix * (filteredOutputs[c][s] - liveOutputs[c][s]);
+    }
+  }
+  return liveOutputs;
+}
+
+sample** NeuralAmpModeler::_ProcessLightCab(sample** inputs, const bool light, const bool toneStack,
+                                           const size_t numFrames)
+{
+  const size_t numChannels = kNumChannelsInternal;
+  // Starting from silence rather than from wherever it was when it was last heard
+  const double startMix = mLightMix;
+  if (startMix == 0.0)
+    mLightCab->cab->Reset();
+  // The IR's output is only needed until it's faded out, but it keeps taking in the input (which is cheap) so that
+  // it's right as soon as it's asked for again.
+  mIR->SetFilteredActive(false);
+  mIR->SetUnfilteredActive(!light || startMix < 1.0);
+  const bool canFade = mIR->IsUnfilteredActive();
+  sample** irOutputs = mIR->Process(inputs, numChannels, numFrames);
+  sample** lightOutputs = mLightCab->cab->Process(inputs, numChannels, numFrames);
+
+  const double step =
+    canFade ? (light ? 1.0 : -1.0) / std::max(kLightCabCrossfadeTime * GetSampleRate(), 1.0) : 0.0;
+  mLightMix = std::clamp(startMix + step * numFrames, 0.0, 1.0);
+  if (light && mLightMix == 1.0)
+    mIR->SetUnfilteredActive(false);
+
+  sample** outputs = lightOutputs;
+  if (startMix == 0.0 && mLightMix == 0.0)
+    outputs = irOutputs;
+  else if (startMix < 1.0 || mLightMix < 1.0)
+  {
+    for (size_t c = 0; c < numChannels; c++)
+    {
+      double mix = startMix;
+      for (size_t s = 0; s < numFrames; s++)
+      {
+        mix = std::clamp(mix + step, 0.0, 1.0);
+        lightOutputs[c][s] = irOutputs[c][s] + mix * (lightOutputs[c][s] - irOutputs[c][s]);
+      }
+    }
+  }
+  return toneStack ? mToneStack->Process(outputs, numChannels, numFrames) : outputs;
+}
+
+void NeuralAmpModeler::_UpdateLightCab()
+{
+  {
+    std::unique_ptr<LightCabFit> retired;
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    retired = std::move(mRetiredLightCab);
+    mRetiredLightCab = nullptr;
+  }
+  if (!GetParam(kLightCab)->Bool() || mRebuildPending)
+    return;
+  std::shared_ptr<const dsp::CachedIR> cachedIR;
+  {
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    cachedIR = mCachedIR;
+  }
+  if (cachedIR == nullptr || mIRPath.GetLength() == 0)
+    return;
+  const double sampleRate = GetSampleRate();
+  if (mLightCabDropped.exchange(false))
+    mRequestedLightCabData.reset();
+  if (mRequestedLightCabData.lock() == cachedIR->data && sampleRate == mRequestedLightCabSampleRate)
+    return;
+  mRequestedLightCabData = cachedIR->data;
+  mRequestedLightCabSampleRate = sampleRate;
+
+  mWorker.Submit([this, cachedIR, sampleRate]() {
+    auto fit = std::make_unique<LightCabFit>();
+    fit->data = cachedIR->data;
+    fit->cab = std::make_unique<dsp::light_cab::LightCab>(*cachedIR->data, sampleRate);
+    auto reports = std::make_shared<const std::vector<dsp::light_cab::Report>>(fit->cab->GetReports());
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    mStagedLightCab = std::move(fit);
+    mLightCabReports = std::move(reports);
+    mLightCabReportsData = cachedIR->data;
+  });
+}
+
+void NeuralAmpModeler::_UpdateFoldedEQ()
+{
+  {
+    // Free the one that the audio thread swapped out (outside of the lock).
+    std::shared_ptr<const FoldedEQ> retired;
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    retired = std::move(mRetiredFoldedEQ);
+    mRetiredFoldedEQ = nullptr;
+  }
+  if (!GetParam(kFoldEQ)->Bool() || !GetParam(kEQActive)->Bool())
+    return;
+  // Wait for the knobs to stop moving.
+  const ToneSettings tone = _GetToneSettings();
+  const auto now = std::chrono::steady_clock::now();
+  if (!(tone == mLastToneSettings))
+  {
+    mLastToneSettings = tone;
+    mLastToneChange = now;
+    return;
+  }
+  if (now - mLastToneChange < kFoldEQSettleTime || mRebuildPending)
+    return;
+
+  std::shared_ptr<const dsp::CachedIR> cachedIR;
+  {
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    cachedIR = mCachedIR;
+  }
+  if (cachedIR == nullptr || mIRPath.GetLength() == 0)
+    return;
+  const double sampleRate = GetSampleRate();
+  const int maxBlockSize = GetBlockSize();
+  // Unless it's already been asked for (and not thrown away since)
+  if (mFoldedEQDropped.exchange(false))
+    mRequestedFoldedData.reset();
+  if (tone == mRequestedFoldedTone && mRequestedFoldedData.lock() == cachedIR->data
+      && sampleRate == mRequestedFoldedSampleRate && maxBlockSize == mRequestedFoldedMaxBlockSize)
+    return;
+  mRequestedFoldedTone = tone;
+  mRequestedFoldedData = cachedIR->data;
+  mRequestedFoldedSampleRate = sampleRate;
+  mRequestedFoldedMaxBlockSize = maxBlockSize;
+
+  mWorker.Submit([this, tone, cachedIR, sampleRate, maxBlockSize]() {
+    // A tone stack of our own to get the impulse response from, since the live one is busy
+    auto toneStack = _MakeToneStack();
+    toneStack->Reset(sampleRate, maxBlockSize);
+    for (int param = 0; param < dsp::tone_stack::kNumParams; param++)
+      toneStack->SetBand((dsp::tone_stack::Param)param, tone.bands[param]);
+    toneStack->SetParam(dsp::tone_stack::kParamBass, tone.bass);
+    toneStack->SetParam(dsp::tone_stack::kParamMiddle, tone.middle);
+    toneStack->SetParam(dsp::tone_stack::kParamTreble, tone.treble);
+    const std::vector<float> filter = toneStack->GetImpulseResponse(_GetFoldedEQLength(sampleRate));
+
+    auto folded = std::make_shared<FoldedEQ>();
+    folded->tone = tone;
+    folded->data = cachedIR->data;
+    folded->sampleRate = sampleRate;
+    folded->kernel = dsp::ConvolutionIR::MakeFilteredKernel(*cachedIR->data, sampleRate, maxBlockSize, filter);
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    // Replaces one that hasn't been picked up yet. If the IR's been replaced since, then the audio thread drops it.
+    mStagedFoldedEQ = std::move(folded);
+  });
+}
+
 size_t NeuralAmpModeler::_GetBufferNumChannels() const
 {
   // Assumes input=output (no mono->stereo effects)
@@ -927,9 +1639,14 @@ size_t NeuralAmpModeler::_GetBufferNumFrames() const
 }
 
 void NeuralAmpModeler::_InitToneStack()
+{
+  mToneStack = _MakeToneStack();
+}
+
+std::unique_ptr<dsp::tone_stack::AbstractToneStack> NeuralAmpModeler::_MakeToneStack()
 {
   // If you want to customize the tone stack, then put it here!
-  mToneStack = std::make_unique<dsp::tone_stack::BasicNamToneStack>();
+  return std::make_unique<dsp::tone_stack::BasicNamToneStack>();
 }
 void NeuralAmpModeler::_PrepareBuffers(const size_t numChannels, const size_t numFrames)
 {
@@ -956,6 +1673,7 @@ void NeuralAmpModeler::_PrepareBuffers(const size_t numChannels, const size_t nu
       mOutputArray[c].resize(numFrames);
       std::fill(mOutputArray[c].begin(), mOutputArray[c].end(), 0.0);
     }
+    mSpectrumTapBuffer.resize(numFrames);
   }
   // Would these ever get changed by something?
   for (auto c = 0; c < mInputArray.size(); c++)
@@ -981,59 +1699,40 @@ void NeuralAmpModeler::_ProcessInput(iplug::sample** inputs, const size_t nFrame
     throw std::runtime_error(ss.str());
   }
 
-  double gain = mInputGain;
+  // Gains are positive, so it's always a ratio.
+  double gain, gainRatio;
+  mInputGain.Next(nFrames, gain, gainRatio);
 #ifndef APP_API
   gain /= (float)nChansIn;
 #endif
-  // 保留立体声信息，不再将输入混合为单声道
+  // 保留立体声信息，不再将输入混合为单声道；如果输入是单声道，则复制到两个通道
   // 假设_PrepareBuffers()已经被调用
-  for (size_t c = 0; c < nChansIn && c < nChansOut; c++)
-  {
-    for (size_t s = 0; s < nFrames; s++)
-    {
-      mInputArray[c][s] = gain * inputs[c][s];
-    }
-  }
-  
-  // 如果输入是单声道但输出需要立体声，则复制到两个通道
-  if (nChansIn == 1 && nChansOut == 2)
-  {
-    for (size_t s = 0; s < nFrames; s++)
-    {
-      mInputArray[1][s] = mInputArray[0][s];
-    }
-  }
+  double* const* detectorSignals = mNoiseGate.GetDetectorSignals(nChansOut, nFrames);
+  dsp::input_stage::Process(inputs, nChansIn, mInputPointers, nFrames, gain, gainRatio, mNoiseGate.GetLink(),
+                            detectorSignals, mInputLevels);
 }
 
 void NeuralAmpModeler::_ProcessOutput(iplug::sample** inputs, iplug::sample** outputs, const size_t nFrames,
-                                      const size_t nChansIn, const size_t nChansOut)
+                                      const size_t nChansOut)
 {
-  // 支持立体声输出
-  const double gain = mOutputGain;
-  
-  // 处理所有可用的输出通道
-  for (size_t c = 0; c < nChansOut && c < nChansIn; c++)
-  {
-    for (size_t s = 0; s < nFrames; s++)
-    {
 #ifdef APP_API // Ensure valid output to interface
-      outputs[c][s] = std::clamp(gain * inputs[c][s], -1.0, 1.0);
+  const bool clamp = true;
 #else // In a DAW, other things may come next and should be able to handle large values.
-      outputs[c][s] = gain * inputs[c][s];
+  const bool clamp = false;
 #endif
-    }
-  }
-  
-  // 如果输入是单声道但输出需要多通道，则复制到所有通道
-  if (nChansIn == 1 && nChansOut > 1)
+  double gain, gainRatio;
+  mOutputGain.Next(nFrames, gain, gainRatio);
+  dsp::OutputStage::Levels levels;
+  mOutputStage.Process(inputs, outputs, nChansOut, nFrames, gain, gainRatio, clamp, levels);
+  mOutputSender.ProcessLevels(levels, nFrames, kCtrlTagOutputMeter);
+  if (mSpectrumTapActive.load(std::memory_order_relaxed) && nChansOut > 0)
   {
-    for (size_t c = 1; c < nChansOut; c++)
-    {
-      for (size_t s = 0; s < nFrames; s++)
-      {
-        outputs[c][s] = outputs[0][s];
-      }
-    }
+    const iplug::sample* left = outputs[0];
+    const iplug::sample* right = outputs[nChansOut > 1 ? 1 : 0];
+    float* tap = mSpectrumTapBuffer.data();
+    for (size_t s = 0; s < nFrames; s++)
+      tap[s] = (float)(0.5 * (left[s] + right[s]));
+    mSpectrumTap.Write(tap, nFrames);
   }
 }
 
@@ -1082,30 +1781,75 @@ void NeuralAmpModeler::_UpdateLatency()
   }
 }
 
-void NeuralAmpModeler::_UpdateMeters(sample** inputPointer, sample** outputPointer, const size_t nFrames,
-                                     const size_t nChansIn, const size_t nChansOut)
+void NeuralAmpModeler::_UpdateTailSize()
 {
-  // 支持立体声电平表
-  // 对于立体声，我们可以选择显示两个通道的平均值或最大值
-  // 这里我们选择显示最大值
-  
-  // 创建临时缓冲区来存储合并后的信号
-  std::vector<sample> inputMerged(nFrames);
-  std::vector<sample> outputMerged(nFrames);
-  
-  for (size_t s = 0; s < nFrames; s++)
+  const double sampleRate = GetSampleRate();
+  // How long a filter with its poles this far from the unit circle (per sample) takes to decay kTailDecayDB
+  auto getDecayTime = [](const double decayRate) { return kTailDecayDB / 20.0 * std::log(10.0) / decayRate; };
+  double tail = 0.0;
+  if (mModel != nullptr)
+    tail += mModel->GetWakeLength() + mModel->GetLatency();
+  if (mIR != nullptr)
+    tail += (double)mIR->GetLength();
+  // The tone stack's slowest filter is the bass, a biquad whose poles decay at w0 / (2Q)...
+  const dsp::tone_stack::Band bass = mToneStack->GetBand(dsp::tone_stack::kParamBass);
+  tail += getDecayTime(M_PI * bass.frequency / (bass.quality * sampleRate));
+  // ...and the DC blocker is a one-pole high-pass with its pole at 1 / (1 + w0).
+  tail += getDecayTime(std::log(1.0 + 2.0 * M_PI * kDCBlockerFrequency / sampleRate));
+
+  const int tailSize = (int)std::ceil(tail);
+  if (GetTailSize() != tailSize)
+    SetTailSize(tailSize);
+}
+
+void NeuralAmpModeler::_UpdateInputMeter(const size_t nFrames)
+{
+  mInputSender.ProcessLevels(mInputLevels, nFrames, kCtrlTagInputMeter);
+}
+
+void NeuralAmpModeler::_UpdateSpectrum()
+{
+  auto* pGraphics = GetUI();
+  auto* settings =
+    pGraphics != nullptr ? static_cast<NAMSettingsPageControl*>(pGraphics->GetControlWithTag(kCtrlTagSettingsBox))
+                         : nullptr;
+  const bool showing = settings != nullptr && !settings->IsHidden();
+  if (showing && !mSpectrumTapActive.load())
+    mSpectrumAnalyzer.Reset();
+  mSpectrumTapActive.store(showing);
+  if (showing && mSpectrumAnalyzer.Update(mSpectrumTap, GetSampleRate()))
+    settings->SetSpectrum(mSpectrumAnalyzer.GetPoints());
+}
+
+void NeuralAmpModeler::_UpdateIRInfo()
+{
+  auto* pGraphics = GetUI();
+  if (pGraphics == nullptr)
+    return;
+  std::shared_ptr<const dsp::CachedIR> cachedIR;
+  std::shared_ptr<const std::vector<dsp::light_cab::Report>> lightCabReports;
   {
-    // 取左右声道的最大值
-    inputMerged[s] = std::max(std::abs(inputPointer[0][s]), std::abs(inputPointer[1][s]));
-    outputMerged[s] = std::max(std::abs(outputPointer[0][s]), std::abs(outputPointer[1][s]));
+    std::lock_guard<std::mutex> lock(mStagingMutex);
+    cachedIR = mCachedIR;
+    // Only if it was fit to this IR
+    if (cachedIR != nullptr && GetParam(kLightCab)->Bool() && mLightCabReportsData.lock() == cachedIR->data)
+      lightCabReports = mLightCabReports;
   }
-  
-  // 使用合并后的信号更新电平表
-  const int nChansHack = 1; // 仍然使用单通道电平表
-  sample* inputMergedPtr = inputMerged.data();
-  sample* outputMergedPtr = outputMerged.data();
-  mInputSender.ProcessBlock(&inputMergedPtr, (int)nFrames, kCtrlTagInputMeter, nChansHack);
-  mOutputSender.ProcessBlock(&outputMergedPtr, (int)nFrames, kCtrlTagOutputMeter, nChansHack);
+  // Same owner (even if it's gone since) means it's the same one.
+  const bool same = !mShownIRInfo.owner_before(cachedIR) && !cachedIR.owner_before(mShownIRInfo);
+  if (mIRInfoShown && same && lightCabReports == mShownLightCabReports)
+    return;
+  auto* settings = static_cast<NAMSettingsPageControl*>(pGraphics->GetControlWithTag(kCtrlTagSettingsBox));
+  if (cachedIR == nullptr)
+    settings->ClearIRInfo();
+  else
+  {
+    settings->SetIRPreprocessing(cachedIR->preprocessing);
+    settings->SetLightCabFit(lightCabReports != nullptr ? *lightCabReports : std::vector<dsp::light_cab::Report>());
+  }
+  mShownIRInfo = cachedIR;
+  mIRInfoShown = true;
+  mShownLightCabReports = std::move(lightCabReports);
 }
 
 // HACK
@@ -1,13 +1,30 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+
 #include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
 #include "AudioDSPTools/dsp/ImpulseResponse.h"
-#include "AudioDSPTools/dsp/NoiseGate.h"
 #include "AudioDSPTools/dsp/dsp.h"
 #include "AudioDSPTools/dsp/wav.h"
 #include "AudioDSPTools/dsp/ResamplingContainer/ResamplingContainer.h"
 
+#include "BackgroundWorker.h"
 #include "Colors.h"
+#include "Convolution.h"
+#include "IRBlend.h"
+#include "IRCache.h"
+#include "IRPreprocessing.h"
+#include "InputStage.h"
+#include "LightCab.h"
+#include "MinimumPhaseResampler.h"
+#include "ModelCache.h"
+#include "OutputStage.h"
+#include "Ramp.h"
+#include "SampleRing.h"
+#include "SpectrumAnalyzer.h"
+#include "StereoNoiseGate.h"
 #include "ToneStack.h"
 
 #include "IPlug_include_in_plug_hdr.h"
@@ -15,16 +32,101 @@
 
 
 const int kNumPresets = 1;
+// How many IRs the IR slot can blend: the main one and the rest
+constexpr size_t kMaxIRBlendFiles = 3;
 // The plugin is mono inside
 constexpr size_t kNumChannelsInternal = 2;
 
-class NAMSender : public iplug::IPeakAvgSender<>
+// Sends (peak, RMS) pairs to a stereo meter like iplug::IPeakAvgSender, but from the levels that the audio pass
+// already worked out for each block instead of going over the samples again. The ballistics run every few
+// milliseconds, but a reading only goes in the (fixed-size, lock-free) queue at about the rate the UI draws.
+class NAMSender : public iplug::ISender<(int)dsp::ChannelLevels::kMaxChannels, 32, std::pair<float, float>>
 {
 public:
-  NAMSender()
-  : iplug::IPeakAvgSender<>(-90.0, true, 5.0f, 1.0f, 300.0f, 500.0f)
+  static constexpr size_t kNumChannels = dsp::ChannelLevels::kMaxChannels;
+
+  void Reset(const double sampleRate)
+  {
+    mSampleRate = sampleRate;
+    mNumFrames = 0;
+    mLevels = dsp::ChannelLevels();
+    mHeldPeak = {};
+    mHeldTime = {};
+    mRMS = {};
+    mTimeSinceSent = 0.0;
+  };
+
+  // Audio thread. Doesn't allocate.
+  // :param levels: The block's largest absolute value and sum of squares, per channel
+  void ProcessLevels(const dsp::ChannelLevels& levels, const size_t numFrames, const int ctrlTag)
   {
-  }
+    for (size_t c = 0; c < kNumChannels; c++)
+    {
+      mLevels.peak[c] = std::max(mLevels.peak[c], levels.peak[c]);
+      mLevels.sumSquares[c] += levels.sumSquares[c];
+    }
+    mNumFrames += numFrames;
+    if ((double)mNumFrames < kWindowTime * mSampleRate)
+      return;
+
+    const double elapsed = mNumFrames / mSampleRate;
+    bool audible = false;
+    for (size_t c = 0; c < kNumChannels; c++)
+    {
+      const double rms = std::sqrt(mLevels.sumSquares[c] / mNumFrames);
+      // The RMS rises and falls smoothly; peaks are held for a bit.
+      const double timeConstant = rms > mRMS[c] ? kAttackTime : kDecayTime;
+      mRMS[c] += (1.0 - std::exp(-elapsed / timeConstant)) * (rms - mRMS[c]);
+      mHeldTime[c] += elapsed;
+      if (mLevels.peak[c] >= mHeldPeak[c] || mHeldTime[c] >= kPeakHoldTime)
+      {
+        mHeldPeak[c] = mLevels.peak[c];
+        mHeldTime[c] = 0.0;
+      }
+      audible = audible || std::max(mHeldPeak[c], mRMS[c]) >= kThreshold;
+    }
+    mNumFrames = 0;
+    mLevels = dsp::ChannelLevels();
+
+    mTimeSinceSent += elapsed;
+    if (mTimeSinceSent < kSendInterval)
+      return;
+    // Quiet's only worth sending once.
+    if (!audible && !mWasAudible)
+      return;
+    // Windows don't line up with the interval, so carry the difference over to keep the average rate.
+    mTimeSinceSent = std::min(mTimeSinceSent - kSendInterval, kSendInterval);
+    mWasAudible = audible;
+    iplug::ISenderData<(int)kNumChannels, std::pair<float, float>> data;
+    data.ctrlTag = ctrlTag;
+    data.nChans = (int)kNumChannels;
+    data.chanOffset = 0;
+    for (size_t c = 0; c < kNumChannels; c++)
+      data.vals[c] = std::make_pair((float)mHeldPeak[c], (float)mRMS[c]);
+    PushData(data);
+  };
+
+private:
+  // -90 dB
+  static constexpr double kThreshold = 3.1622776601683795e-5;
+  // Seconds
+  static constexpr double kWindowTime = 0.005;
+  static constexpr double kAttackTime = 0.001;
+  static constexpr double kDecayTime = 0.3;
+  static constexpr double kPeakHoldTime = 0.5;
+  // About 60 per second, so the queue holds half a second's worth if the UI falls behind
+  static constexpr double kSendInterval = 1.0 / 60.0;
+
+  double mSampleRate = 48000.0;
+  // This window so far
+  size_t mNumFrames = 0;
+  dsp::ChannelLevels mLevels;
+  // What the meter shows
+  std::array<double, kNumChannels> mHeldPeak = {};
+  std::array<double, kNumChannels> mHeldTime = {};
+  std::array<double, kNumChannels> mRMS = {};
+  double mTimeSinceSent = 0.0;
+  bool mWasAudible = false;
 };
 
 // 添加处理模式枚举
@@ -55,6 +157,28 @@ enum EParams
   kProcessingMode,  // 处理模式切换（吉他/人声）
   kABToggle,        // A/B比较切换
   kABMix,           // A/B混合比例
+  // Resample with minimum-phase filters for less latency
+  kMinimumLatency,
+  // IR preprocessing (see IRPreprocessing.h)
+  kIRTrim,
+  kIRTrimThreshold,
+  kIRMinimumPhase,
+  // Fold the tone stack into the IR when its knobs aren't moving
+  kFoldEQ,
+  // IR blend (see IRBlend.h): how each of the IR slot's files goes in, the main one first
+  kIRGain,
+  kIRDelay,
+  kIRInvert,
+  kIRBlend1Gain,
+  kIRBlend1Delay,
+  kIRBlend1Invert,
+  kIRBlend2Gain,
+  kIRBlend2Delay,
+  kIRBlend2Invert,
+  // Run a low-order IIR fit of the IR instead of convolving with it (see LightCab.h)
+  kLightCab,
+  // What the noise gate listens to (see StereoNoiseGate.h)
+  kNoiseGateLink,
   kNumParams
 };
 
@@ -89,6 +213,9 @@ enum EMsgTags
   kMsgTagClearModel = 0,
   kMsgTagClearIR,
   kMsgTagHighlightColor,
+  // Sets one of the IRs that are blended with the main one: the control tag is which (0 for the first), the data its
+  // path (none to take it out)
+  kMsgTagSetIRBlendFile,
   // The following tags are from DSP -> UI
   kMsgTagLoadFailed,
   kMsgTagLoadedModel,
@@ -114,10 +241,15 @@ class ResamplingNAM : public nam::DSP
 {
 public:
   // Resampling wrapper around the NAM models
-  ResamplingNAM(std::unique_ptr<nam::DSP> encapsulated, const double expected_sample_rate)
+  // :param minimumLatency: Resample with minimum-phase filters instead of linear-phase ones. Less latency, but the
+  //   phase response isn't linear anymore.
+  ResamplingNAM(std::unique_ptr<nam::DSP> encapsulated, const double expected_sample_rate,
+                const bool minimumLatency = false)
   : nam::DSP(expected_sample_rate)
   , mEncapsulated(std::move(encapsulated))
   , mResampler(GetNAMSampleRate(mEncapsulated))
+  , mMinimumPhaseResampler(GetNAMSampleRate(mEncapsulated))
+  , mMinimumLatency(minimumLatency)
   {
     // Assign the encapsulated object's processing function  to this object's member so that the resampler can use it:
     auto ProcessBlockFunc = [&](NAM_SAMPLE** input, NAM_SAMPLE** output, int numFrames) {
@@ -151,6 +283,10 @@ public:
 
   ~ResamplingNAM() = default;
 
+  // What it was built from, so that it can be built again (e.g. for another sample rate) without the file
+  void SetModelData(std::shared_ptr<const nam::dspData> modelData) { mModelData = std::move(modelData); };
+  std::shared_ptr<const nam::dspData> GetModelData() const { return mModelData; };
+
   void prewarm() override { mEncapsulated->prewarm(); };
 
   void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override
@@ -158,46 +294,235 @@ public:
     if (num_frames > mMaxExternalBlockSize)
       // We can afford to be careful
       throw std::runtime_error("More frames were provided than the max expected!");
-
-    if (!NeedToResample())
+    // It's heard something, so it's not in its post-prewarm state anymore.
+    mWarm = false;
+    _RecordHistory(input, num_frames);
+    if (mBehind > 0 && !_CatchUp(num_frames))
     {
-      mEncapsulated->process(input, output, num_frames);
-    }
-    else
-    {
-      mResampler.ProcessBlock(&input, &output, num_frames, mBlockProcessFunc);
+      // Nothing to hear until it has
+      std::fill(output, output + num_frames, 0.0);
+      return;
     }
+    _Process(input, output, num_frames);
   };
 
-  int GetLatency() const { return NeedToResample() ? mResampler.GetLatency() : 0; };
+  // Instead of process() when the output doesn't matter (e.g. the noise gate has shut it all the way): the model
+  // doesn't run, but the input goes in the history. Once process() is called again, the model replays the last
+  // GetWakeLength() samples of it, so that it's about where it would have been. That's spread over the next few
+  // blocks (kCatchUpRate), which are silent until it's done.
+  void Skip(const NAM_SAMPLE* input, const int numFrames)
+  {
+    mWarm = false;
+    _RecordHistory(input, numFrames);
+    mBehind = std::min(mBehind + numFrames, mWakeLength);
+  };
+  // How many (host-rate) samples of input it takes to bring the model back to where it would have been after
+  // skipping. Covers the receptive field of the standard WaveNet architectures.
+  int GetWakeLength() const { return mWakeLength; };
+
+  int GetLatency() const
+  {
+    if (!NeedToResample())
+      return 0;
+    return mMinimumLatency ? mMinimumPhaseResampler.GetLatency() : mResampler.GetLatency();
+  };
+
+  // Whether the last Reset() left this ready to process blocks of this size at this sample rate.
+  bool CanProcess(const double sampleRate, const int numFrames) const
+  {
+    return sampleRate == GetExpectedSampleRate() && numFrames <= mMaxExternalBlockSize;
+  };
 
   void Reset(const double sampleRate, const int maxBlockSize) override
   {
     mExpectedSampleRate = sampleRate;
     mMaxExternalBlockSize = maxBlockSize;
+    // Enough input to fill the largest receptive field at the model's rate, plus a bit for the resampler's filters.
+    const int historySize =
+      static_cast<int>(std::ceil(kMaxStateSamples * sampleRate / GetEncapsulatedSampleRate())) + kResamplerMemory;
+    // Prewarming is the same as having heard silence.
+    mHistory.assign(historySize, 0.0);
+    mHistoryWrite = 0;
+    mReplayInput.assign(historySize, 0.0);
+    mReplayOutput.assign(maxBlockSize, 0.0);
+    const int wakeLength = static_cast<int>(std::ceil(kWakeSamples * sampleRate / GetEncapsulatedSampleRate()));
+    mWakeLength = std::min(historySize, wakeLength + kResamplerMemory);
+    mBehind = 0;
     mResampler.Reset(sampleRate, maxBlockSize);
+    // Designing the minimum-phase filters takes a moment, so only do it if they're going to be used.
+    if (mMinimumLatency && NeedToResample())
+      mMinimumPhaseResampler.Reset(sampleRate, maxBlockSize);
 
     // Allocations in the encapsulated model (HACK)
     // Stolen some code from the resampler; it'd be nice to have these exposed as methods? :)
     const double mUpRatio = sampleRate / GetEncapsulatedSampleRate();
-    const auto maxEncapsulatedBlockSize = static_cast<int>(std::ceil(static_cast<double>(maxBlockSize) / mUpRatio));
+    auto maxEncapsulatedBlockSize = static_cast<int>(std::ceil(static_cast<double>(maxBlockSize) / mUpRatio));
+    if (mMinimumLatency && NeedToResample())
+      maxEncapsulatedBlockSize = mMinimumPhaseResampler.GetMaxRenderingBlockSize();
+    // Prewarming is the slow part of loading. If the encapsulated model was prewarmed for this sample rate and at
+    // least this block size and hasn't processed anything since (e.g. the constructor just did it), then it's
+    // already in the state that prewarming would leave it in.
+    if (mWarm && sampleRate == mWarmSampleRate && maxEncapsulatedBlockSize <= mWarmMaxBlockSize)
+      return;
     mEncapsulated->ResetAndPrewarm(sampleRate, maxEncapsulatedBlockSize);
+    mWarm = true;
+    mWarmSampleRate = sampleRate;
+    mWarmMaxBlockSize = maxEncapsulatedBlockSize;
+  };
+
+  int GetMaxBlockSize() const { return mMaxExternalBlockSize; };
+
+  // A snapshot of what the model (and its resampler) remembers, so that it can be put back the way it was later, e.g.
+  // when switching back to it.
+  // The NAM core doesn't expose its layers' buffers, so the snapshot is the input that it heard most recently, enough
+  // to cover the largest receptive field that we support. Restoring replays it.
+  struct State
+  {
+    // Oldest first
+    std::vector<NAM_SAMPLE> history;
+    double sampleRate = 0.0;
+  };
+
+  // Size a state to hold snapshots of this model with its current settings.
+  // Allocates; don't call from the real-time loop.
+  void PrepareState(State& state) const
+  {
+    state.history.assign(mHistory.size(), 0.0);
+    state.sampleRate = GetExpectedSampleRate();
+  };
+
+  // Doesn't allocate if the state was prepared since the last Reset().
+  void SaveState(State& state) const
+  {
+    state.history.resize(mHistory.size());
+    state.sampleRate = GetExpectedSampleRate();
+    _CopyHistory(state.history.data());
+  };
+
+  // Doesn't allocate, but costs about as much as processing state.history.size() samples all at once (a bit more than
+  // kMaxStateSamples at the model's rate), i.e. O(history size x model cost). That's many blocks' worth, so never call
+  // it from the audio thread.
+  // :return: Whether the state could be restored. A state saved at another sample rate can't.
+  bool RestoreState(const State& state)
+  {
+    if (state.sampleRate != GetExpectedSampleRate() || state.history.size() != mHistory.size())
+      return false;
+    // Old enough that whatever the model remembers from before it doesn't matter anymore.
+    mBehind = 0;
+    NAM_SAMPLE* input = const_cast<NAM_SAMPLE*>(state.history.data());
+    const int numFrames = static_cast<int>(state.history.size());
+    // In blocks of the max block size that end where the history does (only the first one may be shorter)
+    for (int start = 0, n = (numFrames - 1) % mMaxExternalBlockSize + 1; start < numFrames;
+         start += n, n = mMaxExternalBlockSize)
+      process(input + start, mReplayOutput.data(), n);
+    return true;
   };
 
   // So that we can let the world know if we're resampling (useful for debugging)
   double GetEncapsulatedSampleRate() const { return GetNAMSampleRate(mEncapsulated); };
+  bool IsMinimumLatency() const { return mMinimumLatency; };
 
 private:
+  // Longest receptive field (in samples at the model's rate) that state snapshots cover
+  static constexpr int kMaxStateSamples = 8192;
+  // Extra (host-rate) samples of history for the resamplers' filters
+  static constexpr int kResamplerMemory = 64;
+  // What the model hears again after Skip() (at the model's rate). The standard WaveNet's receptive field is 4093.
+  static constexpr int kWakeSamples = 4096;
+  // While it's catching up, each process() replays up to this many times its own length, so that no block costs more
+  // than (1 + this) blocks' worth and it catches up by this minus one blocks each time (e.g. 4160 samples in about
+  // 600 at 48kHz). The noise gate is only just opening then anyways.
+  static constexpr int kCatchUpRate = 8;
+
   bool NeedToResample() const { return GetExpectedSampleRate() != GetEncapsulatedSampleRate(); };
+
+  // process() without recording the history
+  void _Process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int numFrames)
+  {
+    if (!NeedToResample())
+    {
+      mEncapsulated->process(input, output, numFrames);
+    }
+    else if (mMinimumLatency)
+    {
+      mMinimumPhaseResampler.ProcessBlock(&input, &output, numFrames, mBlockProcessFunc);
+    }
+    else
+    {
+      mResampler.ProcessBlock(&input, &output, numFrames, mBlockProcessFunc);
+    }
+  };
+
+  // Replays some of what the model is behind on, oldest first. It's in the history, just before the block that was
+  // just recorded, which joins it if it doesn't catch up.
+  // :return: Whether it's caught up, so that the block can be processed
+  bool _CatchUp(const int numFrames)
+  {
+    const int behind = std::min(mBehind, static_cast<int>(mHistory.size()) - numFrames);
+    const int numReplayed = std::min(behind, kCatchUpRate * numFrames);
+    _CopyHistory(mReplayInput.data());
+    NAM_SAMPLE* input = mReplayInput.data() + mReplayInput.size() - numFrames - behind;
+    for (int start = 0; start < numReplayed; start += mMaxExternalBlockSize)
+    {
+      const int n = std::min(mMaxExternalBlockSize, numReplayed - start);
+      _Process(input + start, mReplayOutput.data(), n);
+    }
+    mBehind = numReplayed < behind ? behind - numReplayed + numFrames : 0;
+    return mBehind == 0;
+  };
+
+  // Oldest first
+  void _CopyHistory(NAM_SAMPLE* output) const
+  {
+    auto it = std::copy(mHistory.begin() + mHistoryWrite, mHistory.end(), output);
+    std::copy(mHistory.begin(), mHistory.begin() + mHistoryWrite, it);
+  };
+
+  void _RecordHistory(const NAM_SAMPLE* input, const int numFrames)
+  {
+    const int size = static_cast<int>(mHistory.size());
+    // Only the newest ones survive anyways.
+    const int skip = std::max(0, numFrames - size);
+    for (int i = skip; i < numFrames;)
+    {
+      const int n = std::min(numFrames - i, size - mHistoryWrite);
+      std::copy(input + i, input + i + n, mHistory.begin() + mHistoryWrite);
+      i += n;
+      mHistoryWrite = (mHistoryWrite + n) % size;
+    }
+  };
+
   // The encapsulated NAM
   std::unique_ptr<nam::DSP> mEncapsulated;
+  std::shared_ptr<const nam::dspData> mModelData;
 
   // The resampling wrapper
   dsp::ResamplingContainer<NAM_SAMPLE, 1, 12> mResampler;
+  // ...and its low-latency alternative
+  dsp::resampling::MinimumPhaseResamplingContainer<NAM_SAMPLE> mMinimumPhaseResampler;
+  const bool mMinimumLatency;
 
   // Used to check that we don't get too large a block to process.
   int mMaxExternalBlockSize = 0;
 
+  // Whether the encapsulated model is prewarmed (and unused since) for these settings
+  bool mWarm = false;
+  double mWarmSampleRate = 0.0;
+  int mWarmMaxBlockSize = 0;
+
+  // Ring of the most recent input, for SaveState()
+  std::vector<NAM_SAMPLE> mHistory;
+  int mHistoryWrite = 0;
+  // Where RestoreState() throws away the replay's output
+  std::vector<NAM_SAMPLE> mReplayOutput;
+  // How many samples of the history the model still has to hear (up to mWakeLength of what was skipped, then
+  // whatever came in while it was catching up)
+  int mBehind = 0;
+  // How many of the skipped samples it hears again
+  int mWakeLength = 0;
+  // Where the history is unrolled to replay it
+  std::vector<NAM_SAMPLE> mReplayInput;
+
   // This function is defined to conform to the interface expected by the iPlug2 resampler.
   std::function<void(NAM_SAMPLE**, NAM_SAMPLE**, int)> mBlockProcessFunc;
 };
@@ -226,6 +551,11 @@ public:
   void _StageIRFile(const WDL_String& fileName);
   std::string _StageModel(const std::string& path);
   dsp::wav::LoadReturnCode _StageIR(const std::string& path);
+  // Sets one of the other IRs that are blended with the main one and re-blends them in the background. An empty path
+  // takes it out. See kMsgTagSetIRBlendFile.
+  // :param index: 0 to kMaxIRBlendFiles - 2
+  // :return: Whether the file can be read
+  dsp::wav::LoadReturnCode _StageIRBlendFile(const size_t index, const WDL_String& path);
   
   // 新的文件选择函数
   void _OpenModelFileChooser();
@@ -239,6 +569,8 @@ private:
   // Exists so that we don't try to use a DSP module that's only
   // partially-instantiated.
   void _ApplyDSPStaging();
+  // Hands a model that the audio thread retired to the worker to be put in the model cache.
+  void _CacheRetiredModel();
   // Deallocates mInputPointers and mOutputPointers
   void _DeallocateIOPointers();
   // Fallback that just copies inputs to outputs if mDSP doesn't hold a model.
@@ -247,6 +579,8 @@ private:
   size_t _GetBufferNumChannels() const;
   size_t _GetBufferNumFrames() const;
   void _InitToneStack();
+  // The tone stack that _InitToneStack() uses (also for folding it into the IR)
+  static std::unique_ptr<dsp::tone_stack::AbstractToneStack> _MakeToneStack();
   // Loads a NAM model and stores it to mStagedNAM
   // Returns an empty string on success, or an error message on failure.
   std::string _StageModel(const WDL_String& dspFile);
@@ -256,20 +590,80 @@ private:
   dsp::wav::LoadReturnCode _StageIR(const WDL_String& irPath);
 
   bool _HaveModel() const { return this->mModel != nullptr; };
+  // Whether the live model and IR were set up for this sample rate and block size.
+  // If not, they're waiting to be replaced by the ones that _ResetModelAndIR() is building.
+  bool _LiveDSPCanProcess(const double sampleRate, const int numFrames) const;
   // Prepare the input & output buffers
   void _PrepareBuffers(const size_t numChannels, const size_t numFrames);
+  // Runs what the model would have been hearing recently through it so that it doesn't start cold when it goes live.
+  // That's ResamplingNAM::RestoreState(), as costly as running the model over its whole history, so never on the
+  // audio thread.
+  void _PrimeModel(ResamplingNAM& model);
+  // Takes mModel out of service (audio thread, holding mStagingMutex) and leaves it in mRetiredModel for
+  // _CacheRetiredModel(). Only once that's empty, so that it's never freed on the audio thread.
+  void _RetireModel();
   // Manage pointers
   void _PrepareIOPointers(const size_t nChans);
   // Copy the input buffer to the object, applying input level.
   // :param nChansIn: In from external
   // :param nChansOut: Out to the internal of the DSP routine
   void _ProcessInput(iplug::sample** inputs, const size_t nFrames, const size_t nChansIn, const size_t nChansOut);
-  // Copy the output to the output buffer, applying output level.
-  // :param nChansIn: In from internal
+  // The DC blocker and the output level (and, in the app, the clamp), from the internal channels to the host's
+  // buffers in one pass (see OutputStage.h). Sends the output meter its levels as it goes.
   // :param nChansOut: Out to external
-  void _ProcessOutput(iplug::sample** inputs, iplug::sample** outputs, const size_t nFrames, const size_t nChansIn,
-                      const size_t nChansOut);
+  void _ProcessOutput(iplug::sample** inputs, iplug::sample** outputs, const size_t nFrames, const size_t nChansOut);
+  // The tone stack's knobs and where its filters are, for folding it into the IR
+  struct ToneSettings
+  {
+    double bass = 5.0;
+    double middle = 5.0;
+    double treble = 5.0;
+    std::array<dsp::tone_stack::Band, dsp::tone_stack::kNumParams> bands;
+
+    bool operator==(const ToneSettings& other) const
+    {
+      return bass == other.bass && middle == other.middle && treble == other.treble && bands == other.bands;
+    };
+  };
+  ToneSettings _GetToneSettings() const;
+  // Runs the IR and the tone stack (in that order; both are linear and time-invariant). When the tone stack is folded
+  // into the IR (kFoldEQ), uses the IR's filtered outputs instead, crossfading between them and the live tone stack
+  // as the knobs stop or start moving.
+  // :return: Pointers to the output (kNumChannelsInternal channels)
+  iplug::sample** _ProcessIRAndToneStack(iplug::sample** inputs, const bool toneStackActive, const size_t numFrames);
+  // Takes mFoldedEQ out of service (audio thread, holding mStagingMutex), e.g. because the IR it was made for was
+  // replaced.
+  void _RetireFoldedEQ();
+  // Once the tone stack's knobs have stopped moving, folds it into the IR on mWorker and stages that. Also frees
+  // retired ones. Called from OnIdle().
+  void _UpdateFoldedEQ();
+  // The light cab in place of the convolution (kLightCab), crossfading to and from it. The IR keeps taking in the
+  // input meanwhile so that it can come back without a gap.
+  // :param light: Whether the light cab's wanted (and it's been fit to this IR)
+  iplug::sample** _ProcessLightCab(iplug::sample** inputs, const bool light, const bool toneStack,
+                                   const size_t numFrames);
+  // Takes mLightCab out of service (audio thread, holding mStagingMutex) because the IR it was fit to was replaced.
+  void _RetireLightCab();
+  // While kLightCab is on, fits the IR on mWorker (reporting how close it is) and stages that. Also frees retired
+  // ones. Called from OnIdle().
+  void _UpdateLightCab();
+  // Options for preprocessing IRs from the parameters
+  dsp::ir_preprocessing::Options _GetIRPreprocessingOptions() const;
+  // The IR slot's files and how they're blended, with mainPath as the main one
+  std::vector<dsp::ir_blend::File> _GetIRBlendFiles(const std::string& mainPath) const;
+  // Gets the IR's kernel for these settings from the IR cache. If it's not there, reads the IRs, blends them (at the
+  // first one's sample rate), applies the preprocessing options to that, and makes one.
+  // Not on the audio thread.
+  // :return: nullptr if an IR couldn't be read; wavState says why.
+  static std::shared_ptr<const dsp::CachedIR> _LoadIR(const std::vector<dsp::ir_blend::File>& files,
+                                                      const dsp::ir_preprocessing::Options& options,
+                                                      const double sampleRate, const int maxBlockSize,
+                                                      dsp::wav::LoadReturnCode& wavState);
+  // Re-reads, re-blends, and re-preprocesses the IR on mWorker (when the blend or preprocessing options change) and
+  // stages it.
+  void _RebuildIR();
   // Resetting for models and IRs, called by OnReset
+  // Rebuilds them for the new settings on mWorker and stages the results when they're ready.
   void _ResetModelAndIR(const double sampleRate, const int maxBlockSize);
 
   void _SetInputGain();
@@ -287,12 +681,20 @@ private:
 
   // Make sure that the latency is reported correctly.
   void _UpdateLatency();
+  // Reports how long the chain rings after its input goes silent: the model's memory, the IR, and the filters'
+  // decay. Once it's been silent that long, ProcessBlock() just outputs silence.
+  void _UpdateTailSize();
 
-  // Update level meters
+  // Update the input level meter (_ProcessOutput() does the output's)
   // Called within ProcessBlock().
-  // Assume _ProcessInput() and _ProcessOutput() were run immediately before.
-  void _UpdateMeters(iplug::sample** inputPointer, iplug::sample** outputPointer, const size_t nFrames,
-                     const size_t nChansIn, const size_t nChansOut);
+  // Assume _ProcessInput() was run immediately before.
+  void _UpdateInputMeter(const size_t nFrames);
+  // UI thread (OnIdle()). Runs the spectrum analyzer on what the audio thread's tapped and gives it to the settings
+  // page, but only while that's showing.
+  void _UpdateSpectrum();
+  // UI thread (OnIdle()). Shows what was done to the IR that's loaded (mCachedIR) and how close the light cab's fit
+  // is (while it's on) on the settings page when they change.
+  void _UpdateIRInfo();
 
   // Member data
 
@@ -304,38 +706,126 @@ private:
   iplug::sample** mInputPointers = nullptr;
   iplug::sample** mOutputPointers = nullptr;
 
-  // Input and output gain
-  double mInputGain = 1.0;
-  double mOutputGain = 1.0;
+  // Input and output gain, gliding to their settings over each block
+  dsp::Ramp mInputGain{dsp::Ramp::Shape::Exponential, 1.0};
+  dsp::Ramp mOutputGain{dsp::Ramp::Shape::Exponential, 1.0};
+  // How much of slot B is mixed in
+  dsp::Ramp mABMix{dsp::Ramp::Shape::Linear, 0.0};
+  // What _ProcessInput() measured on its way through the block (after the input gain)
+  dsp::ChannelLevels mInputLevels;
+
+  // How long the input's been silent (up to the tail size and a block); ProcessBlock() sleeps once it's longer than
+  // the tail.
+  size_t mSilentFrames = 0;
 
-  // Noise gates
-  dsp::noise_gate::Trigger mNoiseGateTrigger;
-  dsp::noise_gate::Gain mNoiseGateGain;
+  // Noise gate
+  dsp::stereo_noise_gate::Gate mNoiseGate;
   // The model actually being used:
   std::unique_ptr<ResamplingNAM> mModel;
   // And the IR
-  std::unique_ptr<dsp::ImpulseResponse> mIR;
+  std::unique_ptr<dsp::ConvolutionIR> mIR;
   // Manages switching what DSP is being used.
   std::unique_ptr<ResamplingNAM> mStagedModel;
-  std::unique_ptr<dsp::ImpulseResponse> mStagedIR;
+  std::unique_ptr<dsp::ConvolutionIR> mStagedIR;
+  // The (preprocessed) IR that mStagedIR or mIR was made from, so that changing the sample rate doesn't mean reading
+  // and preprocessing it again. Also keeps it in the IR cache for other instances. Guarded by mStagingMutex.
+  std::shared_ptr<const dsp::CachedIR> mCachedIR;
+  // What mStagedModel or mModel was built from, so that a reset can rebuild it without the file. Guarded by
+  // mStagingMutex.
+  std::shared_ptr<const nam::dspData> mModelData;
+  // What mModel and mStagedModel were loaded from, so that they can be cached when they're replaced.
+  dsp::ModelCacheKey mModelCacheKey;
+  dsp::ModelCacheKey mStagedModelCacheKey;
+  // The audio thread leaves replaced models here (under mStagingMutex) for OnIdle() to re-prewarm and cache them.
+  std::unique_ptr<ResamplingNAM> mRetiredModel;
+  dsp::ModelCacheKey mRetiredModelCacheKey;
+  std::atomic<bool> mHaveRetiredModel = false;
   // Flags to take away the modules at a safe time.
   std::atomic<bool> mShouldRemoveModel = false;
   std::atomic<bool> mShouldRemoveIR = false;
 
   std::atomic<bool> mNewModelLoadedInDSP = false;
   std::atomic<bool> mModelCleared = false;
+  // Guards mStagedModel and mStagedIR. The audio thread only ever try-locks it, so staging never blocks audio.
+  std::mutex mStagingMutex;
+  // Bumped whenever a model (IR) is staged or cleared so that a rebuild that was started before then knows not to
+  // stage its (now stale) result.
+  std::atomic<uint64_t> mModelGeneration = 0;
+  std::atomic<uint64_t> mIRGeneration = 0;
+  // Set while what a rebuild from _ResetModelAndIR() made hasn't been swapped in yet.
+  std::atomic<bool> mRebuildPending = false;
+  // The latest rebuild, and the latest one that's staged what it made. mRebuildPending is cleared once they match and
+  // it's been swapped in.
+  std::atomic<uint64_t> mRebuildGeneration = 0;
+  uint64_t mRebuildStagedGeneration = 0; // Guarded by mStagingMutex
+  // The latest _RebuildIR(); older ones that haven't started yet don't bother.
+  std::atomic<uint64_t> mIRRebuildGeneration = 0;
+  // What the model's been hearing (at the host's rate) on each channel, for _PrimeModel(). Big enough for the longest
+  // state that a ResamplingNAM snapshots at 192kHz.
+  std::array<dsp::SampleRing<iplug::sample>, kNumChannelsInternal> mInputHistory{{{1 << 16}, {1 << 16}}};
 
   // Tone stack modules
   std::unique_ptr<dsp::tone_stack::AbstractToneStack> mToneStack;
 
+  // The tone stack folded into the IR: the filtered outputs' kernels for some settings of its knobs
+  struct FoldedEQ
+  {
+    ToneSettings tone;
+    // The IR it was made for (see dsp::ConvolutionIR::GetDataPointer())
+    std::shared_ptr<const dsp::ConvolutionIR::IRData> data;
+    double sampleRate = 0.0;
+    dsp::convolution::TwoStageKernel kernel;
+  };
+  // The one that mIR's filtered outputs are using (audio thread)...
+  std::shared_ptr<const FoldedEQ> mFoldedEQ;
+  // ...the one that's waiting to be swapped in, and the one that was swapped out for OnIdle() to free (both guarded
+  // by mStagingMutex).
+  std::shared_ptr<const FoldedEQ> mStagedFoldedEQ;
+  std::shared_ptr<const FoldedEQ> mRetiredFoldedEQ;
+  // How far the output's crossfaded from the live tone stack (0) to the IR's filtered outputs (1) (audio thread)
+  double mFoldMix = 0.0;
+  // When the knobs last moved, and what was last sent to the worker to be folded in (OnIdle())
+  ToneSettings mLastToneSettings;
+  std::chrono::steady_clock::time_point mLastToneChange;
+  ToneSettings mRequestedFoldedTone;
+  std::weak_ptr<const dsp::ConvolutionIR::IRData> mRequestedFoldedData;
+  double mRequestedFoldedSampleRate = 0.0;
+  int mRequestedFoldedMaxBlockSize = 0;
+  // Set by the audio thread when it throws one away, so that OnIdle() asks for it again
+  std::atomic<bool> mFoldedEQDropped = false;
+
+  // The IR fit with a low-order IIR filter, for kLightCab
+  struct LightCabFit
+  {
+    // The IR it was fit to (see dsp::ConvolutionIR::GetDataPointer())
+    std::shared_ptr<const dsp::ConvolutionIR::IRData> data;
+    std::unique_ptr<dsp::light_cab::LightCab> cab;
+  };
+  // The one that's fit to mIR (audio thread), and the staged and retired ones like for FoldedEQ
+  std::unique_ptr<LightCabFit> mLightCab;
+  std::unique_ptr<LightCabFit> mStagedLightCab;
+  std::unique_ptr<LightCabFit> mRetiredLightCab;
+  // How far the output's crossfaded from the IR (0) to the light cab (1) (audio thread)
+  double mLightMix = 0.0;
+  // What was last sent to the worker to be fit (OnIdle())
+  std::weak_ptr<const dsp::ConvolutionIR::IRData> mRequestedLightCabData;
+  double mRequestedLightCabSampleRate = 0.0;
+  // How close the last fit came (one per channel) and the IR it was fit to, for the settings page (guarded by
+  // mStagingMutex)
+  std::shared_ptr<const std::vector<dsp::light_cab::Report>> mLightCabReports;
+  std::weak_ptr<const dsp::ConvolutionIR::IRData> mLightCabReportsData;
+  std::atomic<bool> mLightCabDropped = false;
+
   // Post-IR filters
-  recursive_linear_filter::HighPass mHighPass;
-  //  recursive_linear_filter::LowPass mLowPass;
+  // The DC blocker, output level, and output meter
+  dsp::OutputStage mOutputStage;
 
   // Path to model's config.json or model.nam
   WDL_String mNAMPath;
   // Path to IR (.wav file)
   WDL_String mIRPath;
+  // The other IRs blended with it (empty if not used)
+  std::array<WDL_String, kMaxIRBlendFiles - 1> mIRBlendPaths;
 
   WDL_String mHighLightColor{PluginColors::NAM_THEMECOLOR.ToColorCode()};
 
@@ -343,6 +833,19 @@ private:
 
   NAMSender mInputSender, mOutputSender;
 
+  // The output's mid, for the spectrum analyzer. The audio thread only writes to the tap while it's on.
+  std::atomic<bool> mSpectrumTapActive = false;
+  dsp::SampleRing<float> mSpectrumTap{1 << 14};
+  std::vector<float> mSpectrumTapBuffer;
+  dsp::SpectrumAnalyzer mSpectrumAnalyzer;
+
+  // The IR whose info the settings page is showing (see _UpdateIRInfo()), if mIRInfoShown. A weak pointer, so that
+  // it's still told apart from the one that replaced it after it's gone.
+  std::weak_ptr<const dsp::CachedIR> mShownIRInfo;
+  bool mIRInfoShown = false;
+  // Likewise for the light cab's fit (nullptr if none's shown)
+  std::shared_ptr<const std::vector<dsp::light_cab::Report>> mShownLightCabReports;
+
   // 添加模式相关成员变量
   ProcessingMode mCurrentMode = ProcessingMode::GUITAR;
   bool mUsingSlotB = false;  // 用于A/B比较，false=A槽位，true=B槽位
@@ -363,4 +866,8 @@ private:
   // 模式相关函数
   void _UpdateParamsForMode(ProcessingMode mode);
   void _SwitchABSlot(bool useSlotB);
+
+  // Does the slow work (loading, prewarming, resampling) off of the audio thread.
+  // Keep this last so that it's stopped before anything that its jobs use is destroyed.
+  dsp::BackgroundWorker mWorker;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm> // std::max
 #include <cmath> // std::round
 #include <sstream> // std::stringstream
 #include <unordered_map> // std::unordered_map
@@ -407,14 +408,15 @@ private:
   int mClearMsgTag;
 };
 
-class NAMMeterControl : public IVPeakAvgMeterControl<>, public IBitmapBase
+// Left and right side by side
+class NAMMeterControl : public IVPeakAvgMeterControl<2>, public IBitmapBase
 {
   static constexpr float KMeterMin = -70.0f;
   static constexpr float KMeterMax = -0.01f;
 
 public:
   NAMMeterControl(const IRECT& bounds, const IBitmap& bitmap, const IVStyle& style)
-  : IVPeakAvgMeterControl<>(bounds, "", style.WithShowValue(false).WithDrawFrame(false).WithWidgetFrac(0.8),
+  : IVPeakAvgMeterControl<2>(bounds, "", style.WithShowValue(false).WithDrawFrame(false).WithWidgetFrac(0.8),
                             EDirection::Vertical, {}, 0, KMeterMin, KMeterMax, {})
   , IBitmapBase(bitmap)
   {
@@ -426,7 +428,8 @@ public:
   virtual void OnResize() override
   {
     SetTargetRECT(MakeRects(mRECT));
-    mWidgetBounds = mWidgetBounds.GetMidHPadded(5).GetVPadded(10);
+    // Wide enough for two tracks
+    mWidgetBounds = mWidgetBounds.GetMidHPadded(8).GetVPadded(10);
     MakeTrackRects(mWidgetBounds);
     MakeStepRects(mWidgetBounds, mNSteps);
     SetDirty(false);
@@ -447,6 +450,62 @@ public:
   }
 };
 
+// What's coming out, in dB on a log-frequency axis. Someone else works out the spectrum and hands it over with
+// SetSpectrum(); this just draws it.
+class NAMSpectrumControl : public IControl
+{
+  static constexpr float kMinDB = -100.0f;
+  static constexpr float kMaxDB = 0.0f;
+
+public:
+  // :param minFrequency, maxFrequency: Where the spectrum's first and last points are (they're log-spaced)
+  NAMSpectrumControl(const IRECT& bounds, const double minFrequency, const double maxFrequency)
+  : IControl(bounds)
+  , mMinFrequency(minFrequency)
+  , mMaxFrequency(maxFrequency)
+  {
+    mIgnoreMouse = true;
+  }
+
+  void SetSpectrum(const std::vector<float>& points)
+  {
+    mPoints = points;
+    SetDirty(false);
+  }
+
+  void Draw(IGraphics& g) override
+  {
+    g.FillRect(COLOR_BLACK.WithOpacity(0.3f), mRECT, &mBlend);
+    // Lines at 100 Hz, 1 kHz, and 10 kHz
+    const IColor gridColor = PluginColors::HELP_TEXT.WithOpacity(0.2f);
+    for (double f = 100.0; f < mMaxFrequency; f *= 10.0)
+    {
+      const float x = mRECT.L
+                      + mRECT.W() * (float)(std::log(f / mMinFrequency) / std::log(mMaxFrequency / mMinFrequency));
+      g.DrawLine(gridColor, x, mRECT.T, x, mRECT.B, &mBlend);
+    }
+    if (mPoints.size() < 2)
+      return;
+    g.PathClear();
+    for (size_t i = 0; i < mPoints.size(); i++)
+    {
+      const float x = mRECT.L + mRECT.W() * (float)i / (float)(mPoints.size() - 1);
+      const float level = std::clamp((mPoints[i] - kMinDB) / (kMaxDB - kMinDB), 0.0f, 1.0f);
+      const float y = mRECT.B - mRECT.H() * level;
+      if (i == 0)
+        g.PathMoveTo(x, y);
+      else
+        g.PathLineTo(x, y);
+    }
+    g.PathStroke(PluginColors::HELP_TEXT.WithOpacity(0.8f), 1.0f, IStrokeOptions(), &mBlend);
+  }
+
+private:
+  const double mMinFrequency;
+  const double mMaxFrequency;
+  std::vector<float> mPoints;
+};
+
 // Container where we can refer to children by names instead of indices
 class IContainerBaseWithNamedChildren : public IContainerBase
 {
@@ -556,6 +615,95 @@ private:
   bool mHasInfo = false;
 };
 
+// What was done to the IR that's loaded: what preprocessing (see IRPreprocessing.h) did to it, and how close the light
+// cab (see LightCab.h) came to it while that's on. Each line's tooltip has the whole report.
+class IRInfoControl : public IContainerBaseWithNamedChildren
+{
+public:
+  IRInfoControl(const IRECT& bounds, const IVStyle& style)
+  : IContainerBaseWithNamedChildren(bounds)
+  , mStyle(style) {};
+
+  void ClearIRInfo()
+  {
+    for (const auto& name : {mControlNames.preprocessing, mControlNames.lightCab})
+    {
+      auto* control = GetNamedChild(name);
+      static_cast<IVLabelControl*>(control)->SetStr("");
+      control->SetTooltip("");
+    }
+    mHasInfo = false;
+  };
+
+  void Hide(bool hide) override
+  {
+    // Like ModelInfoControl
+    IContainerBase::Hide(hide || (!mHasInfo));
+  };
+
+  void OnAttached() override
+  {
+    AddChildControl(new IVLabelControl(GetRECT().SubRectVertical(3, 0), "IR information:", mStyle));
+    // Not ignoring the mouse so that their tooltips show
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(3, 1), "", mStyle), mControlNames.preprocessing)
+      ->SetIgnoreMouse(false);
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(3, 2), "", mStyle), mControlNames.lightCab)
+      ->SetIgnoreMouse(false);
+  };
+
+  void SetPreprocessing(const dsp::ir_preprocessing::Report& report)
+  {
+    std::stringstream ss;
+    if (report.originalLength == 0)
+      ss << "Not preprocessed";
+    else
+    {
+      const double ms = 1000.0 / report.sampleRate;
+      ss << "Preprocessed: " << (int)std::round(report.originalLength * ms) << " -> "
+         << (int)std::round(report.processedLength * ms) << " ms (~"
+         << (int)std::round(100.0 * report.GetEstimatedCPUSaved()) << "% less CPU)";
+    }
+    auto* preprocessingControl = GetNamedChild(mControlNames.preprocessing);
+    static_cast<IVLabelControl*>(preprocessingControl)->SetStr(ss.str().c_str());
+    std::stringstream tooltip;
+    if (report.originalLength > 0)
+      tooltip << report;
+    preprocessingControl->SetTooltip(tooltip.str().c_str());
+    mHasInfo = true;
+  };
+
+  // One report per channel; none if the light cab's off (or not fit yet)
+  void SetLightCab(const std::vector<dsp::light_cab::Report>& reports)
+  {
+    std::stringstream ss, tooltip;
+    if (!reports.empty())
+    {
+      // The worst channel's
+      double rmsErrorDB = 0.0, maxErrorDB = 0.0;
+      for (const auto& report : reports)
+      {
+        rmsErrorDB = std::max(rmsErrorDB, report.rmsErrorDB);
+        maxErrorDB = std::max(maxErrorDB, report.maxErrorDB);
+        tooltip << (&report == &reports.front() ? "" : "\n") << report;
+      }
+      ss << "Light cab fit: " << std::round(10.0 * rmsErrorDB) / 10.0 << " dB RMS error ("
+         << std::round(10.0 * maxErrorDB) / 10.0 << " dB at worst)";
+    }
+    auto* lightCabControl = GetNamedChild(mControlNames.lightCab);
+    static_cast<IVLabelControl*>(lightCabControl)->SetStr(ss.str().c_str());
+    lightCabControl->SetTooltip(tooltip.str().c_str());
+  };
+
+private:
+  const IVStyle mStyle;
+  struct
+  {
+    const std::string preprocessing = "preprocessing";
+    const std::string lightCab = "lightCab";
+  } mControlNames;
+  bool mHasInfo = false;
+};
+
 class OutputModeControl : public IVRadioButtonControl
 {
 public:
@@ -674,12 +822,14 @@ public:
     AddNamedChildControl(new IVLabelControl(titleArea, "SETTINGS", titleStyle), mControlNames.title);
 
     // Attach input/output calibration controls
+    float inputOutputBottom = 0.0f;
     {
       const float height = NAM_KNOB_HEIGHT + NAM_SWTICH_HEIGHT + 10.0f;
       const float width = titleArea.W();
       const auto inputOutputArea = titleArea.GetFromBottom(height).GetTranslated(0.0f, height);
       const auto inputArea = inputOutputArea.GetFromLeft(0.5f * width);
       const auto outputArea = inputOutputArea.GetFromRight(0.5f * width);
+      inputOutputBottom = inputOutputArea.B;
 
       const float knobWidth = 87.0f; // HACK based on looking at the main page knobs.
       const auto inputLevelArea =
@@ -712,10 +862,20 @@ public:
     const auto bottomArea = GetRECT().GetPadded(-pad).GetFromBottom(78.0f);
     const float lineHeight = 15.0f;
     const auto modelInfoArea = bottomArea.GetFromLeft(halfWidth).GetFromTop(4 * lineHeight);
+    // Only the model info's first two lines are used; the IR's goes under them.
+    const auto irInfoArea =
+      bottomArea.GetFromLeft(halfWidth).GetReducedFromTop(2 * lineHeight).GetFromTop(3 * lineHeight);
     const auto aboutArea = bottomArea.GetFromRight(halfWidth).GetFromTop(5 * lineHeight);
     AddNamedChildControl(new ModelInfoControl(modelInfoArea, leftStyle), mControlNames.modelInfo);
+    AddNamedChildControl(new IRInfoControl(irInfoArea, leftStyle), mControlNames.irInfo);
     AddNamedChildControl(new AboutControl(aboutArea, leftStyle, leftText), mControlNames.about);
 
+    // The output's spectrum, in between
+    const auto spectrumArea = IRECT(titleArea.L, inputOutputBottom, titleArea.R, bottomArea.T).GetVPadded(-5.0f);
+    AddNamedChildControl(new NAMSpectrumControl(spectrumArea, dsp::SpectrumAnalyzer::kMinFrequency,
+                                                dsp::SpectrumAnalyzer::kMaxFrequency),
+                         mControlNames.spectrum);
+
     auto closeAction = [&](IControl* pCaller) {
       static_cast<NAMSettingsPageControl*>(pCaller->GetParent())->HideAnimated(true);
     };
@@ -732,6 +892,37 @@ public:
     modelInfoControl->SetModelInfo(modelInfo);
   };
 
+  void ClearIRInfo()
+  {
+    auto* irInfoControl = static_cast<IRInfoControl*>(GetNamedChild(mControlNames.irInfo));
+    assert(irInfoControl != nullptr);
+    irInfoControl->ClearIRInfo();
+  };
+
+  // See IRInfoControl
+  void SetIRPreprocessing(const dsp::ir_preprocessing::Report& report)
+  {
+    auto* irInfoControl = static_cast<IRInfoControl*>(GetNamedChild(mControlNames.irInfo));
+    assert(irInfoControl != nullptr);
+    irInfoControl->SetPreprocessing(report);
+  };
+
+  // See IRInfoControl
+  void SetLightCabFit(const std::vector<dsp::light_cab::Report>& reports)
+  {
+    auto* irInfoControl = static_cast<IRInfoControl*>(GetNamedChild(mControlNames.irInfo));
+    assert(irInfoControl != nullptr);
+    irInfoControl->SetLightCab(reports);
+  };
+
+  // See NAMSpectrumControl
+  void SetSpectrum(const std::vector<float>& points)
+  {
+    auto* spectrumControl = static_cast<NAMSpectrumControl*>(GetNamedChild(mControlNames.spectrum));
+    assert(spectrumControl != nullptr);
+    spectrumControl->SetSpectrum(points);
+  };
+
 private:
   IBitmap mBitmap;
   IBitmap mInputLevelBackgroundBitmap;
@@ -751,8 +942,10 @@ private:
     const std::string calibrateInput = "CalibrateInput";
     const std::string close = "Close";
     const std::string inputCalibrationLevel = "InputCalibrationLevel";
+    const std::string irInfo = "IRInfo";
     const std::string modelInfo = "ModelInfo";
     const std::string outputMode = "OutputMode";
+    const std::string spectrum = "Spectrum";
     const std::string title = "Title";
   } mControlNames;
 
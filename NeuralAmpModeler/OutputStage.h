@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "architecture.hpp"
+
+#ifdef ARCH_EXT_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace dsp
+{
+// How loud a block was, per channel
+struct ChannelLevels
+{
+  static constexpr size_t kMaxChannels = 2;
+  std::array<double, kMaxChannels> peak = {};
+  std::array<double, kMaxChannels> sumSquares = {};
+};
+
+// The end of the chain in one pass over the block: the DC blocker, the output gain, (optionally) clamping, writing to
+// the host's buffers, and the levels for the output meter. The channels go in pairs, one per SIMD lane.
+class OutputStage
+{
+public:
+  static constexpr size_t kMaxChannels = ChannelLevels::kMaxChannels;
+  // What a block came out at (after the gain and clamp)
+  using Levels = ChannelLevels;
+
+  // The DC blocker is a one-pole high-pass, like recursive_linear_filter::HighPass.
+  void SetSampleRate(const double sampleRate, const double dcBlockerFrequency)
+  {
+    const double c = 2.0 * M_PI * dcBlockerFrequency / sampleRate;
+    mCoefficient = 1.0 / (1.0 + c);
+  };
+  void Reset()
+  {
+    mLastInput = {};
+    mLastOutput = {};
+  };
+
+  // Doesn't allocate.
+  // :param inputs: kMaxChannels of them
+  // :param numOutputs: What the host wants. With one, it gets the first channel; with more than kMaxChannels, the
+  //   extra ones are silent.
+  // :param gain: For the first frame...
+  // :param gainRatio: ...and what it's multiplied by for each one after (see Ramp)
+  // :param clamp: Keep the output within [-1, 1] (e.g. for an audio interface)
+  void Process(const double* const* inputs, double* const* outputs, const size_t numOutputs, const size_t numFrames,
+               const double gain, const double gainRatio, const bool clamp, Levels& levels)
+  {
+    levels = Levels();
+    if (numOutputs == 0)
+      return;
+    // (None if the host only wants one channel)
+    double* outputR = numOutputs > 1 ? outputs[1] : nullptr;
+#ifdef ARCH_EXT_SSE2
+    const __m128d a = _mm_set1_pd(mCoefficient);
+    __m128d g = _mm_set1_pd(gain);
+    const __m128d gStep = _mm_set1_pd(gainRatio);
+    const __m128d lo = _mm_set1_pd(clamp ? -1.0 : -HUGE_VAL);
+    const __m128d hi = _mm_set1_pd(clamp ? 1.0 : HUGE_VAL);
+    const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+    __m128d lastInput = _mm_loadu_pd(mLastInput.data());
+    __m128d lastOutput = _mm_loadu_pd(mLastOutput.data());
+    __m128d peak = _mm_setzero_pd();
+    __m128d sumSquares = _mm_setzero_pd();
+    const double* inputL = inputs[0];
+    const double* inputR = inputs[1];
+    double* outputL = outputs[0];
+    for (size_t s = 0; s < numFrames; s++)
+    {
+      const __m128d x = _mm_set_pd(inputR[s], inputL[s]);
+      lastOutput = _mm_mul_pd(a, _mm_add_pd(lastOutput, _mm_sub_pd(x, lastInput)));
+      lastInput = x;
+      const __m128d y = _mm_min_pd(_mm_max_pd(_mm_mul_pd(g, lastOutput), lo), hi);
+      g = _mm_mul_pd(g, gStep);
+      peak = _mm_max_pd(peak, _mm_and_pd(y, absMask));
+      sumSquares = _mm_add_pd(sumSquares, _mm_mul_pd(y, y));
+      _mm_storel_pd(outputL + s, y);
+      if (outputR != nullptr)
+        _mm_storeh_pd(outputR + s, y);
+    }
+    _mm_storeu_pd(mLastInput.data(), lastInput);
+    _mm_storeu_pd(mLastOutput.data(), lastOutput);
+    _mm_storeu_pd(levels.peak.data(), peak);
+    _mm_storeu_pd(levels.sumSquares.data(), sumSquares);
+#else
+    for (size_t c = 0; c < kMaxChannels; c++)
+    {
+      const double* input = inputs[c];
+      double* output = c == 0 ? outputs[0] : outputR;
+      double lastInput = mLastInput[c];
+      double lastOutput = mLastOutput[c];
+      double peak = 0.0;
+      double sumSquares = 0.0;
+      double frameGain = gain;
+      for (size_t s = 0; s < numFrames; s++)
+      {
+        lastOutput = mCoefficient * (lastOutput + input[s] - lastInput);
+        lastInput = input[s];
+        double y = frameGain * lastOutput;
+        frameGain *= gainRatio;
+        if (clamp)
+          y = std::clamp(y, -1.0, 1.0);
+        peak = std::max(peak, std::abs(y));
+        sumSquares += y * y;
+        if (output != nullptr)
+          output[s] = y;
+      }
+      mLastInput[c] = lastInput;
+      mLastOutput[c] = lastOutput;
+      levels.peak[c] = peak;
+      levels.sumSquares[c] = sumSquares;
+    }
+#endif
+    for (size_t c = kMaxChannels; c < numOutputs; c++)
+      std::fill(outputs[c], outputs[c] + numFrames, 0.0);
+  };
+
+private:
+  double mCoefficient = 1.0;
+  // The DC blocker's state
+  std::array<double, kMaxChannels> mLastInput = {};
+  std::array<double, kMaxChannels> mLastOutput = {};
+};
+}; // namespace dsp
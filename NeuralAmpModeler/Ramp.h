@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace dsp
+{
+// A setting (e.g. a gain) that glides from where it was to where it's set over the next block instead of stepping at
+// the block's start, so that automation is smooth however big the blocks are.
+class Ramp
+{
+public:
+  enum class Shape
+  {
+    // The same amount each sample
+    Linear,
+    // The same factor each sample, i.e. linear in dB, for gains. Stays linear if either end isn't positive.
+    Exponential
+  };
+
+  Ramp(const Shape shape, const double value)
+  : mShape(shape)
+  , mCurrent(value)
+  , mTarget(value)
+  {
+  }
+
+  void SetTarget(const double value) { mTarget = value; };
+  double GetTarget() const { return mTarget; };
+  // Straight there (e.g. after a reset)
+  void Jump() { mCurrent = mTarget; };
+
+  // Audio thread, once per block. The value for the block's first sample and how it changes from one sample to the
+  // next (added if linear, multiplied if exponential); it's at the target by the block's last sample.
+  // :return: Whether it's exponential
+  bool Next(const size_t numFrames, double& first, double& step)
+  {
+    const bool exponential = mShape == Shape::Exponential && mCurrent > 0.0 && mTarget > 0.0;
+    if (mCurrent == mTarget || numFrames == 0)
+    {
+      first = mTarget;
+      step = exponential ? 1.0 : 0.0;
+    }
+    else if (exponential)
+    {
+      step = std::pow(mTarget / mCurrent, 1.0 / (double)numFrames);
+      first = mCurrent * step;
+    }
+    else
+    {
+      step = (mTarget - mCurrent) / (double)numFrames;
+      first = mCurrent + step;
+    }
+    mCurrent = mTarget;
+    return exponential;
+  };
+
+private:
+  const Shape mShape;
+  double mCurrent;
+  double mTarget;
+};
+}; // namespace dsp
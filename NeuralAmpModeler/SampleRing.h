@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Spectral.h"
+
+namespace dsp
+{
+// Keeps the most recent samples that one thread (e.g. the audio thread) writes so that another one can look at them.
+// The writer never waits or allocates; it just writes over whatever's oldest. The reader finds out if that happened to
+// what it was copying and can try again.
+template <typename T>
+class SampleRing
+{
+public:
+  // Allocates; the capacity is rounded up to a power of two.
+  SampleRing(const size_t capacity)
+  : mBuffer(spectral::NextPowerOfTwo(std::max<size_t>(capacity, 1)), (T)0)
+  , mMask(mBuffer.size() - 1)
+  {
+  }
+
+  size_t GetCapacity() const { return mBuffer.size(); };
+  // How many samples have been written in all (e.g. for a reader to tell whether there's anything new)
+  uint64_t GetNumWritten() const { return mWritten.load(std::memory_order_acquire); };
+
+  // Writer only.
+  void Write(const T* input, const size_t numFrames)
+  {
+    const uint64_t write = mWritten.load(std::memory_order_relaxed);
+    // Let the reader know what's about to be written over before writing over it.
+    mWriting.store(write + numFrames, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    // Only the newest ones survive anyways.
+    const size_t skip = numFrames > mBuffer.size() ? numFrames - mBuffer.size() : 0;
+    for (size_t i = skip; i < numFrames;)
+    {
+      const size_t position = (size_t)((write + i) & mMask);
+      const size_t n = std::min(numFrames - i, mBuffer.size() - position);
+      std::copy(input + i, input + i + n, mBuffer.begin() + position);
+      i += n;
+    }
+    mWritten.store(write + numFrames, std::memory_order_release);
+  };
+
+  // Reader only. Copies the numFrames most recent samples to output, oldest first. Whatever's older than what's been
+  // written (or than the capacity) comes out as zeros.
+  // :return: false if the writer wrote over some of them while they were being copied. Try again.
+  bool ReadLatest(T* output, const size_t numFrames) const
+  {
+    const uint64_t end = mWritten.load(std::memory_order_acquire);
+    const size_t available = (size_t)std::min<uint64_t>({end, (uint64_t)numFrames, (uint64_t)mBuffer.size()});
+    const size_t numZeros = numFrames - available;
+    std::fill(output, output + numZeros, (T)0);
+    const uint64_t start = end - available;
+    for (size_t i = 0; i < available;)
+    {
+      const size_t position = (size_t)((start + i) & mMask);
+      const size_t n = std::min(available - i, mBuffer.size() - position);
+      std::copy(mBuffer.begin() + position, mBuffer.begin() + position + n, output + numZeros + i);
+      i += n;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Anything older than capacity samples before the end of what the writer's gotten to is gone.
+    return mWriting.load(std::memory_order_relaxed) - start <= mBuffer.size();
+  };
+
+private:
+  std::vector<T> mBuffer;
+  const uint64_t mMask;
+  // Total samples written so far...
+  std::atomic<uint64_t> mWritten = 0;
+  // ...and that will have been written when the current Write() is done
+  std::atomic<uint64_t> mWriting = 0;
+};
+}; // namespace dsp
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include <unsupported/Eigen/FFT>
+
+namespace dsp
+{
+namespace spectral
+{
+inline size_t NextPowerOfTwo(const size_t n)
+{
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+};
+
+// Real-input FFT of a fixed (power-of-two) size.
+// Resize() allocates and makes the plans; after that, Forward() and Inverse() don't allocate, so they're safe to use
+// in the real-time loop.
+template <typename T>
+class RealFFT
+{
+public:
+  RealFFT(const size_t size = 0)
+  {
+    mFFT.SetFlag(Eigen::FFT<T>::HalfSpectrum);
+    Resize(size);
+  };
+
+  void Resize(const size_t size)
+  {
+    mSize = size;
+    if (mSize == 0)
+      return;
+    // Run it once each way so that the plans and scratch buffers exist before we're on the audio thread.
+    std::vector<T> time(mSize, (T)0);
+    std::vector<std::complex<T>> freq(GetNumBins());
+    Forward(time.data(), freq.data());
+    Inverse(freq.data(), time.data());
+  };
+
+  size_t GetSize() const { return mSize; };
+  size_t GetNumBins() const { return mSize / 2 + 1; };
+
+  // :param input: GetSize() samples
+  // :param output: GetNumBins() bins
+  void Forward(const T* input, std::complex<T>* output) { mFFT.fwd(output, input, (Eigen::Index)mSize); };
+  // Scaled so that Inverse(Forward(x)) == x
+  void Inverse(const std::complex<T>* input, T* output) { mFFT.inv(output, input, (Eigen::Index)mSize); };
+
+private:
+  Eigen::FFT<T> mFFT;
+  size_t mSize = 0;
+};
+
+// Replace h with the minimum-phase filter that has (nearly) the same magnitude response, using the real cepstrum.
+// The result has the same length as h; make h long enough that the minimum-phase version's tail has died out.
+// Allocates; don't call from the real-time loop.
+// :param fftSize: Zero-padded length used for the cepstrum (more is less aliasing). 0 means "pick for me".
+inline void MakeMinimumPhase(std::vector<double>& h, size_t fftSize = 0)
+{
+  if (h.size() < 2)
+    return;
+  const size_t n = fftSize == 0 ? NextPowerOfTwo(8 * h.size()) : NextPowerOfTwo(std::max(fftSize, h.size()));
+  Eigen::FFT<double> fft;
+  std::vector<std::complex<double>> time(n, 0.0);
+  std::vector<std::complex<double>> freq(n);
+  std::copy(h.begin(), h.end(), time.begin());
+  fft.fwd(freq, time);
+
+  // Floor the magnitude well below anything audible so that stopband zeros don't blow up the log.
+  double peak = 0.0;
+  for (const auto& x : freq)
+    peak = std::max(peak, std::abs(x));
+  const double floor = std::max(peak, 1.0e-30) * 1.0e-9; // -180 dB
+  for (auto& x : freq)
+    x = std::log(std::max(std::abs(x), floor));
+
+  // Real cepstrum, then fold the anti-causal half onto the causal half.
+  fft.inv(time, freq);
+  for (size_t i = 1; i < n / 2; i++)
+    time[i] *= 2.0;
+  for (size_t i = n / 2 + 1; i < n; i++)
+    time[i] = 0.0;
+  for (auto& x : time)
+    x = x.real();
+
+  fft.fwd(freq, time);
+  for (auto& x : freq)
+    x = std::exp(x);
+  fft.inv(time, freq);
+  for (size_t i = 0; i < h.size(); i++)
+    h[i] = time[i].real();
+};
+}; // namespace spectral
+}; // namespace dsp
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "SampleRing.h"
+#include "Spectral.h"
+
+namespace dsp
+{
+// Turns the latest samples in a SampleRing into a smoothed spectrum on a log-frequency axis, for drawing. All of it
+// happens on whatever thread calls Update() (e.g. the UI's, in OnIdle()); the audio thread only writes to the ring.
+// It always looks at the most recent samples, so if it can't keep up, the frames in between are just never
+// analyzed.
+class SpectrumAnalyzer
+{
+public:
+  static constexpr size_t kFFTSize = 4096;
+  // Look again once this many new samples are in
+  static constexpr size_t kHopSize = kFFTSize / 4;
+  static constexpr size_t kNumPoints = 256;
+  static constexpr double kMinFrequency = 20.0;
+  static constexpr double kMaxFrequency = 20000.0;
+  // dB (0 is a full-scale sine)
+  static constexpr float kFloorDB = -120.0f;
+  // How fast it falls back when things get quieter (dB per second); it rises right away.
+  static constexpr double kFallRate = 60.0;
+
+  // Allocates.
+  SpectrumAnalyzer()
+  : mFFT(kFFTSize)
+  , mWindow(kFFTSize)
+  , mSamples(kFFTSize)
+  , mBins(mFFT.GetNumBins())
+  , mPower(mFFT.GetNumBins())
+  , mPoints(kNumPoints, kFloorDB)
+  {
+    // Hann, scaled so that a full-scale sine reads 0 dB
+    double sum = 0.0;
+    for (size_t i = 0; i < kFFTSize; i++)
+    {
+      mWindow[i] = (float)(0.5 - 0.5 * std::cos(2.0 * M_PI * i / kFFTSize));
+      sum += mWindow[i];
+    }
+    for (auto& w : mWindow)
+      w *= (float)(2.0 / sum);
+  };
+
+  // Back to silence
+  void Reset() { std::fill(mPoints.begin(), mPoints.end(), kFloorDB); };
+
+  // Analyzes the ring's latest samples if enough new ones have come in since last time.
+  // :return: Whether there's a new spectrum. Not if there's nothing new, or if the writer wrote over what was being
+  //   read (that frame's dropped; the next call will look at newer samples).
+  bool Update(const SampleRing<float>& ring, const double sampleRate)
+  {
+    const uint64_t written = ring.GetNumWritten();
+    if (written < mLastWritten) // Someone else's ring?
+      mLastWritten = 0;
+    if (written - mLastWritten < kHopSize)
+      return false;
+    if (!ring.ReadLatest(mSamples.data(), kFFTSize))
+      return false;
+    const double elapsed = std::min((double)(written - mLastWritten), (double)kFFTSize) / sampleRate;
+    mLastWritten = written;
+    if (sampleRate != mSampleRate)
+      _SetSampleRate(sampleRate);
+
+    for (size_t i = 0; i < kFFTSize; i++)
+      mSamples[i] *= mWindow[i];
+    mFFT.Forward(mSamples.data(), mBins.data());
+    for (size_t k = 0; k < mBins.size(); k++)
+      mPower[k] = std::norm(mBins[k]);
+
+    const float fall = (float)(kFallRate * elapsed);
+    for (size_t p = 0; p < kNumPoints; p++)
+    {
+      const Band& band = mBands[p];
+      double power;
+      if (band.last > band.first)
+        power = *std::max_element(mPower.begin() + band.first, mPower.begin() + band.last);
+      else // Narrower than a bin: in between the two nearest
+        power = (1.0 - band.fraction) * mPower[band.first] + band.fraction * mPower[band.first + 1];
+      const float db = std::max(kFloorDB, (float)(10.0 * std::log10(std::max(power, 1.0e-30))));
+      mPoints[p] = std::max(db, mPoints[p] - fall);
+    }
+    return true;
+  };
+
+  // dB at each of kNumPoints frequencies (see GetFrequency())
+  const std::vector<float>& GetPoints() const { return mPoints; };
+
+  // Log-spaced from kMinFrequency to kMaxFrequency
+  static double GetFrequency(const size_t point)
+  {
+    return kMinFrequency * std::pow(kMaxFrequency / kMinFrequency, (double)point / (kNumPoints - 1));
+  };
+
+private:
+  // The bins that go into a point
+  struct Band
+  {
+    size_t first = 0;
+    // One past; not more than first if it's narrower than a bin...
+    size_t last = 0;
+    // ...in which case it's this far from first to the next one
+    double fraction = 0.0;
+  };
+
+  void _SetSampleRate(const double sampleRate)
+  {
+    mSampleRate = sampleRate;
+    mBands.resize(kNumPoints);
+    const double binsPerHz = kFFTSize / sampleRate;
+    const double lastBin = (double)(mFFT.GetNumBins() - 1);
+    // Each point covers from halfway (in log frequency) to the one before it to halfway to the one after.
+    const double halfStep = std::sqrt(std::pow(kMaxFrequency / kMinFrequency, 1.0 / (kNumPoints - 1)));
+    for (size_t p = 0; p < kNumPoints; p++)
+    {
+      const double center = std::min(GetFrequency(p) * binsPerHz, lastBin - 1.0);
+      const double low = std::min(center / halfStep, lastBin);
+      const double high = std::min(center * halfStep, lastBin);
+      Band& band = mBands[p];
+      band.first = (size_t)std::ceil(low);
+      band.last = (size_t)std::floor(high) + 1;
+      band.fraction = 0.0;
+      if (band.last <= band.first)
+      {
+        band.first = (size_t)center;
+        band.last = band.first;
+        band.fraction = center - band.first;
+      }
+    }
+  };
+
+  spectral::RealFFT<float> mFFT;
+  std::vector<float> mWindow;
+  std::vector<float> mSamples;
+  std::vector<std::complex<float>> mBins;
+  std::vector<double> mPower;
+  std::vector<Band> mBands;
+  std::vector<float> mPoints;
+  double mSampleRate = 0.0;
+  // As of the last Update() that looked
+  uint64_t mLastWritten = 0;
+};
+}; // namespace dsp
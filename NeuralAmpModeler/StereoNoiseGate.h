@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "AudioDSPTools/dsp/dsp.h"
+#include "architecture.hpp"
+
+#ifdef ARCH_EXT_SSE2
+  #include <emmintrin.h>
+#endif
+
+namespace dsp
+{
+namespace stereo_noise_gate
+{
+// What the gate listens to
+enum class Link
+{
+  // Each channel on its own, with its own gain
+  Off = 0,
+  // The louder channel, sample by sample
+  Max,
+  // (L + R) / 2
+  Mid
+};
+
+// Same behavior as noise_gate::Trigger and noise_gate::Gain, but the trigger and the gain are one object, and with a
+// link the channels share one detector and one gain curve, so that the stereo image doesn't wander as the gate moves
+// and the detector runs once instead of once per channel.
+// Detect() before the model (it doesn't change the signal), Apply() after.
+class Gate
+{
+public:
+  struct Params
+  {
+    // Envelope half-life (seconds)
+    double time = 0.01;
+    // dB
+    double threshold = -80.0;
+    // Gain reduction (dB) is ratio * (dB below the threshold)^2
+    double ratio = 0.1;
+    double openTime = 0.005;
+    double holdTime = 0.01;
+    double closeTime = 0.05;
+  };
+
+  // Allocates. Back to open.
+  void Reset(const double sampleRate, const size_t maxBlockSize)
+  {
+    mSampleRate = sampleRate;
+    _PrepareBuffers(kNumChannelsMax, maxBlockSize);
+    for (auto& detector : mDetectors)
+      detector = Detector();
+  };
+  void SetParams(const Params& params) { mParams = params; };
+  // Takes effect at the next Detect(). The detectors carry on from where they were.
+  void SetLink(const Link link) { mLink = link; };
+
+  Link GetLink() const { return mLink; };
+
+  // Works out the gain for this block. Doesn't allocate as long as Reset() was told about a block this big.
+  void Detect(DSP_SAMPLE** inputs, const size_t numChannels, const size_t numFrames)
+  {
+    double* const* signals = GetDetectorSignals(numChannels, numFrames);
+    if (mLink != Link::Off && numChannels > 1)
+      _DetectorSignal(inputs[0], inputs[1], signals[0], numFrames);
+    else
+      for (size_t c = 0; c < numChannels; c++)
+        for (size_t s = 0; s < numFrames; s++)
+          signals[c][s] = inputs[c][s] * inputs[c][s];
+    DetectFromSignals(numChannels, numFrames);
+  };
+
+  // For working out the detector's signal while going over the input anyways (see InputStage.h) instead of in
+  // Detect(): where it goes. It's the square of each channel, or when they're linked (and there's more than one),
+  // just one: max(L^2, R^2) or ((L + R) / 2)^2. Doesn't allocate as long as Reset() was told about a block this big.
+  double* const* GetDetectorSignals(const size_t numChannels, const size_t numFrames)
+  {
+    _PrepareBuffers(numChannels, numFrames);
+    return mDetectorSignalPointers.data();
+  };
+  // Detect() from what's been put in GetDetectorSignals()
+  void DetectFromSignals(const size_t numChannels, const size_t numFrames)
+  {
+    _PrepareBuffers(numChannels, numFrames);
+    mNumChannels = numChannels;
+    mLinked = mLink != Link::Off && numChannels > 1;
+    for (size_t d = 0; d < (mLinked ? 1 : numChannels); d++)
+      _Follow(mDetectors[d], mDetectorSignals[d].data(), mGains[d].data(), numFrames);
+  };
+
+  // How long (in samples, as of the end of the last Detect()) the gate has been shut on every channel, i.e. with at
+  // least kClosedGainReductionDB of gain reduction. Whatever it's gating can't be heard then.
+  size_t GetClosedFrames() const
+  {
+    if (mNumChannels == 0)
+      return 0;
+    size_t closedFrames = mDetectors[0].closedFrames;
+    for (size_t c = 1; c < (mLinked ? 1 : mNumChannels); c++)
+      closedFrames = std::min(closedFrames, mDetectors[c].closedFrames);
+    return closedFrames;
+  };
+  static constexpr double kClosedGainReductionDB = -90.0;
+
+  // Applies the gain from the last Detect() (same block size and channels).
+  DSP_SAMPLE** Apply(DSP_SAMPLE** inputs, const size_t numChannels, const size_t numFrames)
+  {
+    for (size_t c = 0; c < numChannels; c++)
+    {
+      const double* gain = mGains[mLinked ? 0 : c].data();
+      const DSP_SAMPLE* input = inputs[c];
+      DSP_SAMPLE* output = mOutputs[c].data();
+      for (size_t s = 0; s < numFrames; s++)
+        output[s] = gain[s] * input[s];
+    }
+    return mOutputPointers.data();
+  };
+
+private:
+  static constexpr size_t kNumChannelsMax = 2;
+  static constexpr double kMinimumLevel = 1.0e-12; // -120 dB
+  static constexpr double kMaximumLevel = 1000.0;
+
+  enum class State
+  {
+    Holding, // Open
+    Moving
+  };
+  struct Detector
+  {
+    // Mean square
+    double level = kMinimumLevel;
+    State state = State::Holding;
+    double timeHeld = 0.0;
+    double gainReductionDB = 0.0;
+    // pow() only when it moves
+    double gainReductionDBForGain = 0.0;
+    double gain = 1.0;
+    size_t closedFrames = 0;
+  };
+
+  double _GetGainReductionDB(const double levelDB) const
+  {
+    const double below = levelDB - mParams.threshold;
+    return below < 0.0 ? -mParams.ratio * below * below : 0.0;
+  };
+
+  // Squared, so it goes straight into the envelope
+  void _DetectorSignal(const DSP_SAMPLE* left, const DSP_SAMPLE* right, double* output, const size_t numFrames) const
+  {
+    size_t s = 0;
+#ifdef ARCH_EXT_SSE2
+    const __m128d half = _mm_set1_pd(0.5);
+    if (mLink == Link::Max)
+    {
+      for (; s + 2 <= numFrames; s += 2)
+      {
+        const __m128d l = _mm_loadu_pd(left + s);
+        const __m128d r = _mm_loadu_pd(right + s);
+        _mm_storeu_pd(output + s, _mm_max_pd(_mm_mul_pd(l, l), _mm_mul_pd(r, r)));
+      }
+    }
+    else
+    {
+      for (; s + 2 <= numFrames; s += 2)
+      {
+        const __m128d m = _mm_mul_pd(half, _mm_add_pd(_mm_loadu_pd(left + s), _mm_loadu_pd(right + s)));
+        _mm_storeu_pd(output + s, _mm_mul_pd(m, m));
+      }
+    }
+#endif
+    for (; s < numFrames; s++)
+    {
+      if (mLink == Link::Max)
+        output[s] = std::max(left[s] * left[s], right[s] * right[s]);
+      else
+      {
+        const double m = 0.5 * (left[s] + right[s]);
+        output[s] = m * m;
+      }
+    }
+  };
+
+  // The envelope and the open/hold/close state machine, one sample at a time because each depends on the last. Only
+  // takes logs and powers while the gate is moving.
+  void _Follow(Detector& d, const double* signal, double* gain, const size_t numFrames) const
+  {
+    const double alpha = std::pow(0.5, 1.0 / (mParams.time * mSampleRate));
+    const double beta = 1.0 - alpha;
+    const double dt = 1.0 / mSampleRate;
+    // Comparing powers instead of dB while it's open
+    const double thresholdLevel = std::pow(10.0, 0.1 * mParams.threshold);
+    const double maxGainReductionDB = _GetGainReductionDB(-120.0);
+    // How far it can open or close in a sample
+    const double dOpen = -maxGainReductionDB / mParams.openTime * dt; // >0
+    const double dClose = maxGainReductionDB / mParams.closeTime * dt; // <0
+
+    for (size_t s = 0; s < numFrames; s++)
+    {
+      d.level = std::clamp(alpha * d.level + beta * signal[s], kMinimumLevel, kMaximumLevel);
+      if (d.state == State::Holding)
+      {
+        d.gainReductionDB = 0.0;
+        if (d.level < thresholdLevel)
+        {
+          d.timeHeld += dt;
+          if (d.timeHeld >= mParams.holdTime)
+            d.state = State::Moving;
+        }
+        else
+          d.timeHeld = 0.0;
+      }
+      else
+      {
+        const double target = _GetGainReductionDB(10.0 * std::log10(d.level));
+        if (target > d.gainReductionDB)
+        {
+          d.gainReductionDB += std::clamp(0.5 * (target - d.gainReductionDB), 0.0, dOpen);
+          if (d.gainReductionDB >= 0.0)
+          {
+            d.gainReductionDB = 0.0;
+            d.state = State::Holding;
+            d.timeHeld = 0.0;
+          }
+        }
+        else if (target < d.gainReductionDB)
+        {
+          d.gainReductionDB += std::clamp(0.5 * (target - d.gainReductionDB), dClose, 0.0);
+          d.gainReductionDB = std::max(d.gainReductionDB, maxGainReductionDB);
+        }
+      }
+      if (d.gainReductionDB != d.gainReductionDBForGain)
+      {
+        d.gainReductionDBForGain = d.gainReductionDB;
+        d.gain = std::pow(10.0, d.gainReductionDB / 20.0);
+      }
+      gain[s] = d.gain;
+      d.closedFrames = d.gainReductionDB <= kClosedGainReductionDB ? d.closedFrames + 1 : 0;
+    }
+  };
+
+  void _PrepareBuffers(const size_t numChannels, const size_t numFrames)
+  {
+    const size_t channels = std::max(numChannels, kNumChannelsMax);
+    if (mDetectors.size() < channels)
+      mDetectors.resize(channels);
+    if (mGains.size() < channels)
+      mGains.resize(channels);
+    if (mOutputs.size() < channels)
+      mOutputs.resize(channels);
+    if (mDetectorSignals.size() < channels)
+      mDetectorSignals.resize(channels);
+    if (mDetectorSignalPointers.size() < channels)
+      mDetectorSignalPointers.resize(channels);
+    for (size_t c = 0; c < channels; c++)
+    {
+      if (mDetectorSignals[c].size() < numFrames)
+        mDetectorSignals[c].resize(numFrames);
+      mDetectorSignalPointers[c] = mDetectorSignals[c].data();
+      if (mGains[c].size() < numFrames)
+        mGains[c].resize(numFrames);
+      if (mOutputs[c].size() < numFrames)
+        mOutputs[c].resize(numFrames);
+    }
+    if (mOutputPointers.size() < channels)
+      mOutputPointers.resize(channels);
+    for (size_t c = 0; c < channels; c++)
+      mOutputPointers[c] = mOutputs[c].data();
+  };
+
+  Params mParams;
+  Link mLink = Link::Max;
+  double mSampleRate = 48000.0;
+  // As of the last Detect()
+  size_t mNumChannels = 0;
+  bool mLinked = false;
+
+  // One per channel, or just the first when linked
+  std::vector<Detector> mDetectors;
+  std::vector<std::vector<double>> mGains;
+  std::vector<std::vector<double>> mDetectorSignals;
+  std::vector<double*> mDetectorSignalPointers;
+  std::vector<std::vector<DSP_SAMPLE>> mOutputs;
+  std::vector<DSP_SAMPLE*> mOutputPointers;
+};
+}; // namespace stereo_noise_gate
+}; // namespace dsp
@@ -1,61 +1,231 @@
+#include <algorithm>
+#include <cmath>
+
 #include "ToneStack.h"
 
+std::vector<float> dsp::tone_stack::AbstractToneStack::GetImpulseResponse(const size_t length)
+{
+  std::vector<DSP_SAMPLE> impulse(length, 0.0);
+  if (length == 0)
+    return std::vector<float>();
+  impulse[0] = 1.0;
+  DSP_SAMPLE* inputs[1] = {impulse.data()};
+  DSP_SAMPLE** outputs = Process(inputs, 1, (int)length);
+  return std::vector<float>(outputs[0], outputs[0] + length);
+}
+
 DSP_SAMPLE** dsp::tone_stack::BasicNamToneStack::Process(DSP_SAMPLE** inputs, const int numChannels,
                                                          const int numFrames)
 {
-  DSP_SAMPLE** bassPointers = mToneBass.Process(inputs, numChannels, numFrames);
-  DSP_SAMPLE** midPointers = mToneMid.Process(bassPointers, numChannels, numFrames);
-  DSP_SAMPLE** treblePointers = mToneTreble.Process(midPointers, numChannels, numFrames);
-  return treblePointers;
+  // (Only allocates if it's more than Reset() was told about.)
+  if (mOutputs.size() < (size_t)numChannels)
+    mOutputs.resize(numChannels);
+  mOutputPointers.resize(mOutputs.size());
+  mSubBlockInputs.resize(mOutputs.size());
+  mSubBlockOutputs.resize(mOutputs.size());
+  for (size_t c = 0; c < mOutputs.size(); c++)
+  {
+    if (mOutputs[c].size() < (size_t)numFrames)
+      mOutputs[c].resize(numFrames);
+    mOutputPointers[c] = mOutputs[c].data();
+  }
+
+  // The same table for the whole block
+  const CoefficientTable& table = mTables.BeginRead();
+  if (table.version != mTableVersion)
+  {
+    mTableVersion = table.version;
+    mRefresh = true;
+  }
+  for (int start = 0; start < numFrames; start += kSubBlockSize)
+  {
+    _UpdateCoefficients(table);
+    for (int c = 0; c < numChannels; c++)
+    {
+      mSubBlockInputs[c] = inputs[c] + start;
+      mSubBlockOutputs[c] = mOutputPointers[c] + start;
+    }
+    mCascade.Process(mSubBlockInputs.data(), mSubBlockOutputs.data(), numChannels,
+                     std::min(kSubBlockSize, numFrames - start));
+  }
+  mTables.EndRead();
+  return mOutputPointers.data();
 }
 
 void dsp::tone_stack::BasicNamToneStack::Reset(const double sampleRate, const int maxBlockSize)
 {
   dsp::tone_stack::AbstractToneStack::Reset(sampleRate, maxBlockSize);
+  // Stereo's the most it's run with.
+  const size_t numChannels = 2;
+  mOutputs.resize(numChannels);
+  for (auto& output : mOutputs)
+    output.resize(std::max(maxBlockSize, 1));
+  mOutputPointers.resize(numChannels);
+  mSubBlockInputs.resize(numChannels);
+  mSubBlockOutputs.resize(numChannels);
+  mCascade.SetNumChannels(numChannels);
+  mCascade.Reset();
 
+  mSmoothing = 1.0 - std::exp(-(double)kSubBlockSize / (kSmoothingTime * sampleRate));
   // Refresh the params!
-  SetParam("bass", mBassVal);
-  SetParam("middle", mMiddleVal);
-  SetParam("treble", mTrebleVal);
+  mJump = true;
+  std::lock_guard<std::mutex> lock(mDesignMutex);
+  mDesignSampleRate = sampleRate;
 }
 
-void dsp::tone_stack::BasicNamToneStack::SetParam(const std::string name, const double val)
+void dsp::tone_stack::BasicNamToneStack::Prepare(const double sampleRate)
 {
-  if (name == "bass")
+  std::lock_guard<std::mutex> lock(mDesignMutex);
+  _Publish(sampleRate);
+}
+
+void dsp::tone_stack::BasicNamToneStack::SetParam(const Param param, const double val)
+{
+  // Process() glides the filters there.
+  if (param >= 0 && param < kNumParams)
+    mTargets[param].store(val, std::memory_order_relaxed);
+}
+
+void dsp::tone_stack::BasicNamToneStack::SetBand(const Param param, const Band& band)
+{
+  if (param < 0 || param >= kNumParams)
+    return;
+  std::lock_guard<std::mutex> lock(mDesignMutex);
+  if (band == GetBand(param))
+    return;
+  mFrequencies[param] = band.frequency;
+  mQualities[param] = band.quality;
+  _Publish(mDesignSampleRate);
+}
+
+dsp::tone_stack::Band dsp::tone_stack::BasicNamToneStack::GetBand(const Param param) const
+{
+  Band band;
+  if (param >= 0 && param < kNumParams)
   {
-    // HACK: Store for refresh
-    mBassVal = val;
-    const double sampleRate = GetSampleRate();
-    const double bassGainDB = 4.0 * (val - 5.0); // +/- 20
-    // Hey ChatGPT, the bass frequency is 150 Hz!
-    const double bassFrequency = 150.0;
-    const double bassQuality = 0.707;
-    recursive_linear_filter::BiquadParams bassParams(sampleRate, bassFrequency, bassQuality, bassGainDB);
-    mToneBass.SetParams(bassParams);
+    band.frequency = mFrequencies[param];
+    band.quality = mQualities[param];
   }
-  else if (name == "middle")
+  return band;
+}
+
+dsp::tone_stack::Band dsp::tone_stack::BasicNamToneStack::GetDefaultBand(const Param param)
+{
+  Band band;
+  switch (param)
+  {
+    case kParamBass:
+      // Hey ChatGPT, the bass frequency is 150 Hz!
+      band.frequency = 150.0;
+      band.quality = 0.707;
+      break;
+    case kParamMiddle:
+      // Hey ChatGPT, the middle frequency is 425 Hz!
+      band.frequency = 425.0;
+      band.quality = 0.7;
+      break;
+    case kParamTreble:
+      // Hey ChatGPT, the treble frequency is 1800 Hz!
+      band.frequency = 1800.0;
+      band.quality = 0.707;
+      break;
+    default: break;
+  }
+  return band;
+}
+
+dsp::biquad::Coefficients dsp::tone_stack::BasicNamToneStack::GetCoefficients(const Param param, const double val,
+                                                                             const double sampleRate, const Band& band)
+{
+  switch (param)
   {
-    // HACK: Store for refresh
-    mMiddleVal = val;
-    const double sampleRate = GetSampleRate();
-    const double midGainDB = 3.0 * (val - 5.0); // +/- 15
-    // Hey ChatGPT, the middle frequency is 425 Hz!
-    const double midFrequency = 425.0;
-    // Wider EQ on mid bump up to sound less honky.
-    const double midQuality = midGainDB < 0.0 ? 1.5 : 0.7;
-    recursive_linear_filter::BiquadParams midParams(sampleRate, midFrequency, midQuality, midGainDB);
-    mToneMid.SetParams(midParams);
+    case kParamBass:
+    {
+      const double bassGainDB = 4.0 * (val - 5.0); // +/- 20
+      return biquad::LowShelf(sampleRate, band.frequency, band.quality, bassGainDB);
+    }
+    case kParamMiddle:
+    {
+      const double midGainDB = 3.0 * (val - 5.0); // +/- 15
+      // Wider EQ on mid bump up to sound less honky.
+      const double midQuality = midGainDB < 0.0 ? band.quality * (1.5 / 0.7) : band.quality;
+      return biquad::Peaking(sampleRate, band.frequency, midQuality, midGainDB);
+    }
+    case kParamTreble:
+    {
+      const double trebleGainDB = 2.0 * (val - 5.0); // +/- 10
+      return biquad::HighShelf(sampleRate, band.frequency, band.quality, trebleGainDB);
+    }
+    default: return biquad::Coefficients();
   }
-  else if (name == "treble")
+}
+
+void dsp::tone_stack::BasicNamToneStack::_Publish(const double sampleRate)
+{
+  std::array<Band, kNumParams> bands;
+  for (int param = 0; param < kNumParams; param++)
+    bands[param] = GetBand((Param)param);
+  const uint64_t version = ++mDesignVersion;
+  mTables.Write([&](CoefficientTable& table) {
+    table.version = version;
+    table.sampleRate = sampleRate;
+    table.bands = bands;
+    for (int param = 0; param < kNumParams; param++)
+    {
+      table.coefficients[param].resize(sampleRate > 0.0 ? kTableSize : 0);
+      for (size_t i = 0; i < table.coefficients[param].size(); i++)
+        table.coefficients[param][i] =
+          GetCoefficients((Param)param, 10.0 * (double)i / (double)(kTableSize - 1), sampleRate, bands[param]);
+    }
+  });
+}
+
+void dsp::tone_stack::BasicNamToneStack::_UpdateCoefficients(const CoefficientTable& table)
+{
+  // Nothing to filter at yet
+  if (GetSampleRate() <= 0.0)
+    return;
+  for (int param = 0; param < kNumParams; param++)
   {
-    // HACK: Store for refresh
-    mTrebleVal = val;
-    const double sampleRate = GetSampleRate();
-    const double trebleGainDB = 2.0 * (val - 5.0); // +/- 10
-    // Hey ChatGPT, the treble frequency is 1800 Hz!
-    const double trebleFrequency = 1800.0;
-    const double trebleQuality = 0.707;
-    recursive_linear_filter::BiquadParams trebleParams(sampleRate, trebleFrequency, trebleQuality, trebleGainDB);
-    mToneTreble.SetParams(trebleParams);
+    const double target = mTargets[param].load(std::memory_order_relaxed);
+    double value = mValues[param];
+    if (mJump)
+      value = target;
+    else if (value != target)
+    {
+      value += mSmoothing * (target - value);
+      // Close enough (in knob units) to land
+      if (std::abs(target - value) < 1.0e-3)
+        value = target;
+    }
+    else if (!mRefresh)
+      continue;
+    mValues[param] = value;
+    mCascade.SetCoefficients(param, _LookUp(table, (Param)param, value));
   }
+  mJump = false;
+  mRefresh = false;
+}
+
+dsp::biquad::Coefficients dsp::tone_stack::BasicNamToneStack::_LookUp(const CoefficientTable& table,
+                                                                     const Param param, const double val) const
+{
+  // E.g. it's been reset to a new sample rate and Prepare() hasn't made one for it yet
+  if (table.sampleRate != GetSampleRate() || table.coefficients[param].size() != kTableSize)
+    return GetCoefficients(param, val, GetSampleRate(), table.bands[param]);
+  // Linear between settings. A biquad's stable if its (a1, a2) is in a triangle, so anything between two stable ones
+  // is stable too.
+  const std::vector<biquad::Coefficients>& coefficients = table.coefficients[param];
+  const double position = std::clamp(val, 0.0, 10.0) * 0.1 * (double)(kTableSize - 1);
+  const size_t i = std::min((size_t)position, kTableSize - 2);
+  const double frac = position - (double)i;
+  const biquad::Coefficients& lo = coefficients[i];
+  const biquad::Coefficients& hi = coefficients[i + 1];
+  biquad::Coefficients c;
+  c.b0 = lo.b0 + frac * (hi.b0 - lo.b0);
+  c.b1 = lo.b1 + frac * (hi.b1 - lo.b1);
+  c.b2 = lo.b2 + frac * (hi.b2 - lo.b2);
+  c.a1 = lo.a1 + frac * (hi.a1 - lo.a1);
+  c.a2 = lo.a2 + frac * (hi.a2 - lo.a2);
+  return c;
 }
@@ -1,16 +1,42 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "AudioDSPTools/dsp/dsp.h"
-#include "AudioDSPTools/dsp/RecursiveLinearFilter.h"
+#include "BiquadCascade.h"
+#include "DoubleBuffer.h"
 
 namespace dsp
 {
 namespace tone_stack
 {
+// The knobs a tone stack can have
+enum Param
+{
+  kParamBass = 0,
+  kParamMiddle,
+  kParamTreble,
+  kNumParams
+};
+
+// Where a knob's filter is
+struct Band
+{
+  double frequency = 1000.0;
+  double quality = 0.707;
+
+  bool operator==(const Band& other) const { return frequency == other.frequency && quality == other.quality; };
+};
+
 class AbstractToneStack
 {
 public:
+  virtual ~AbstractToneStack() = default;
   // Compute in the real-time loop
   virtual DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const int numChannels, const int numFrames) = 0;
   // Any preparation. Call from Reset() in the plugin
@@ -19,14 +45,35 @@ public:
     mSampleRate = sampleRate;
     mMaxBlockSize = maxBlockSize;
   };
-  // Set the various parameters of your tone stack by name.
-  // Call this during OnParamChange()
-  virtual void SetParam(const std::string name, const double val) = 0;
+  // Preparation that's too slow for Reset() (e.g. that allocates), for a background thread. Safe to call while
+  // Process() is running. The tone stack works without it, just not as efficiently.
+  virtual void Prepare(const double sampleRate) {};
+  // Set the various parameters of your tone stack.
+  // Call this during OnParamChange(). Safe to call while Process() is running.
+  virtual void SetParam(const Param param, const double val) = 0;
+  // Moves a knob's filter. Safe to call while Process() is running, but not from it (it can take a while). Tone
+  // stacks that can't move theirs ignore it.
+  virtual void SetBand(const Param param, const Band& band) {};
+  virtual Band GetBand(const Param param) const { return Band(); };
+  void SetBassFreq(const double frequency) { _SetFrequency(kParamBass, frequency); };
+  void SetMidFreq(const double frequency) { _SetFrequency(kParamMiddle, frequency); };
+  void SetTrebleFreq(const double frequency) { _SetFrequency(kParamTreble, frequency); };
+  // The impulse response with the current settings, from rest, e.g. to fold it into an IR. Runs the tone stack, so
+  // use one that isn't in the real-time loop. Allocates.
+  std::vector<float> GetImpulseResponse(const size_t length);
 
 protected:
   double GetSampleRate() const { return mSampleRate; };
   double mSampleRate = 0.0;
   int mMaxBlockSize = 0;
+
+private:
+  void _SetFrequency(const Param param, const double frequency)
+  {
+    Band band = GetBand(param);
+    band.frequency = frequency;
+    SetBand(param, band);
+  };
 };
 
 class BasicNamToneStack : public AbstractToneStack
@@ -34,27 +81,91 @@ class BasicNamToneStack : public AbstractToneStack
 public:
   BasicNamToneStack()
   {
-    SetParam("bass", 5.0);
-    SetParam("middle", 5.0);
-    SetParam("treble", 5.0);
+    for (int param = 0; param < kNumParams; param++)
+    {
+      mTargets[param] = 5.0;
+      const Band band = GetDefaultBand((Param)param);
+      mFrequencies[param] = band.frequency;
+      mQualities[param] = band.quality;
+    }
+    // So that Process() has them before there's a table
+    _Publish(0.0);
   };
   ~BasicNamToneStack() = default;
 
-  DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const int numChannels, const int numFrames);
+  DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const int numChannels, const int numFrames) override;
   virtual void Reset(const double sampleRate, const int maxBlockSize) override;
+  // Makes the coefficient table for this sample rate.
+  void Prepare(const double sampleRate) override;
   // :param val: Assumed to be between 0 and 10, 5 is "noon"
-  virtual void SetParam(const std::string name, const double val) override;
+  virtual void SetParam(const Param param, const double val) override;
+  // Remakes the coefficient table (for the sample rate from Reset()) and hands it to Process().
+  void SetBand(const Param param, const Band& band) override;
+  Band GetBand(const Param param) const override;
 
+  // Bass at 150Hz, middle at 425Hz, and treble at 1800Hz
+  static Band GetDefaultBand(const Param param);
+  // The filter for a knob's setting (with trig; see Prepare()). The middle's narrower when it cuts than when it
+  // boosts (by 1.5 / 0.7).
+  static biquad::Coefficients GetCoefficients(const Param param, const double val, const double sampleRate,
+                                              const Band& band);
 
 protected:
-  recursive_linear_filter::LowShelf mToneBass;
-  recursive_linear_filter::Peaking mToneMid;
-  recursive_linear_filter::HighShelf mToneTreble;
-
-  // HACK not DRY w knob defs
-  double mBassVal = 5.0;
-  double mMiddleVal = 5.0;
-  double mTrebleVal = 5.0;
+  // Coefficients for every setting of the knobs for some bands at one sample rate, so that moving them doesn't need
+  // any trig
+  struct CoefficientTable
+  {
+    // Which one it is, so that Process() knows when there's a new one
+    uint64_t version = 0;
+    double sampleRate = 0.0;
+    std::array<Band, kNumParams> bands;
+    // [param][setting], kTableSize of them from 0 to 10 (none if sampleRate is 0)
+    std::array<std::vector<biquad::Coefficients>, kNumParams> coefficients;
+  };
+  // In steps of 0.1, like the knobs, so that they're exact wherever they're left
+  static constexpr size_t kTableSize = 101;
+  // Knob moves glide over this long (seconds)...
+  static constexpr double kSmoothingTime = 0.02;
+  // ...and the filters follow them every this many samples.
+  static constexpr int kSubBlockSize = 16;
+
+  // Makes a table for the bands as they are now and hands it to Process() (holding mDesignMutex).
+  void _Publish(const double sampleRate);
+  // Moves the knobs one sub-block closer to where they're set to and updates the filters to match (audio thread).
+  void _UpdateCoefficients(const CoefficientTable& table);
+  // From the table (interpolated) if it's for this sample rate
+  biquad::Coefficients _LookUp(const CoefficientTable& table, const Param param, const double val) const;
+
+  // Bass (low shelf), middle (peaking), and treble (high shelf), all in one pass
+  biquad::Cascade<kNumParams> mCascade;
+  std::vector<std::vector<DSP_SAMPLE>> mOutputs;
+  std::vector<DSP_SAMPLE*> mOutputPointers;
+  // The current sub-block
+  std::vector<const DSP_SAMPLE*> mSubBlockInputs;
+  std::vector<DSP_SAMPLE*> mSubBlockOutputs;
+
+  // Where the knobs are set to...
+  std::array<std::atomic<double>, kNumParams> mTargets;
+  // ...and where the filters are (audio thread)
+  std::array<double, kNumParams> mValues = {5.0, 5.0, 5.0};
+  // How much closer they get each sub-block
+  double mSmoothing = 1.0;
+  // Set the filters to the knobs without gliding (e.g. after Reset())...
+  bool mJump = true;
+  // ...or just recompute them where they are (e.g. with a new table).
+  bool mRefresh = false;
+  // The last table that Process() used
+  uint64_t mTableVersion = 0;
+
+  // The bands (any thread; written holding mDesignMutex), and the sample rate from Reset() to make tables for when
+  // they change
+  std::array<std::atomic<double>, kNumParams> mFrequencies;
+  std::array<std::atomic<double>, kNumParams> mQualities;
+  double mDesignSampleRate = 0.0;
+  uint64_t mDesignVersion = 0;
+  std::mutex mDesignMutex;
+  // The latest table for Process(), swapped in between blocks so that the filters never change mid-sub-block
+  DoubleBuffer<CoefficientTable> mTables;
 };
 }; // namespace tone_stack
 }; // namespace dsp
@@ -56,6 +56,12 @@ void NeuralAmpModeler::_UnserializeApplyConfig(nlohmann::json& config)
 
   mNAMPath.Set(static_cast<std::string>(config["NAMPath"]).c_str());
   mIRPath.Set(static_cast<std::string>(config["IRPath"]).c_str());
+  // Before the IR's staged so that it's blended in
+  for (size_t i = 0; i < mIRBlendPaths.size(); i++)
+  {
+    const std::string key = "IRBlend" + std::to_string(i + 1) + "Path";
+    mIRBlendPaths[i].Set(config.contains(key) ? static_cast<std::string>(config[key]).c_str() : "");
+  }
 
   if (mNAMPath.GetLength())
   {
@@ -87,6 +93,48 @@ int _UnserializePathsAndExpectedKeys(const iplug::IByteChunk& chunk, int startPo
   return pos;
 }
 
+// The IR blend, from after the params (see SerializeState()). There's no telling how many params a version wrote, but
+// they're all doubles, so look for its header at the end of each one.
+// :return: Where it ends, or startPos if it's not there
+int _UnserializeIRBlend(const iplug::IByteChunk& chunk, const int startPos, nlohmann::json& config)
+{
+  const int maxNumParams = 1024;
+  const int headerLength = (int)kIRBlendHeader.size();
+  for (int i = 0, pos = startPos; i < maxNumParams && pos + (int)sizeof(int) + headerLength <= chunk.Size();
+       i++, pos += (int)sizeof(double))
+  {
+    // Check the length first so that a double that happens to look like a huge one isn't read as a string.
+    int length = 0;
+    chunk.Get(&length, pos);
+    if (length != headerLength)
+      continue;
+    WDL_String header;
+    int blendPos = chunk.GetStr(header, pos);
+    if (kIRBlendHeader != header.Get())
+      continue;
+    int numFiles = 0;
+    blendPos = chunk.Get(&numFiles, blendPos);
+    for (int file = 0; file < numFiles && blendPos >= 0; file++)
+    {
+      if (file > 0)
+      {
+        WDL_String path;
+        blendPos = chunk.GetStr(path, blendPos);
+        config["IRBlend" + std::to_string(file) + "Path"] = std::string(path.Get());
+      }
+      for (const char* what : {"Gain", "Delay", "Invert"})
+      {
+        double v = 0.0;
+        blendPos = blendPos >= 0 ? chunk.Get(&v, blendPos) : blendPos;
+        if (blendPos >= 0)
+          config[_GetIRBlendParamName(file, what)] = v;
+      }
+    }
+    return blendPos >= 0 ? blendPos : startPos;
+  }
+  return startPos;
+}
+
 void _RenameKeys(nlohmann::json& j, std::unordered_map<std::string, std::string> newNames)
 {
   // Assumes no aliasing!
@@ -265,6 +313,7 @@ int NeuralAmpModeler::_UnserializeStateWithKnownVersion(const iplug::IByteChunk&
     // You shouldn't be here...
     assert(false);
   }
+  pos = _UnserializeIRBlend(chunk, pos, config);
   _UnserializeApplyConfig(config);
   return pos;
 }
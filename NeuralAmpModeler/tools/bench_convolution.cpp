@@ -0,0 +1,82 @@
+// Times the uniformly-partitioned convolver (Convolution.h) against direct (time-domain) convolution like
+// dsp::ImpulseResponse does, for IRs from 512 to 65536 samples.
+// Usage: bench_convolution [block size]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "Convolution.h"
+
+namespace
+{
+// Measured cost of convolving with an IR of some length.
+struct BenchmarkResult
+{
+  size_t irLength;
+  // Nanoseconds per sample
+  double partitioned;
+  double direct;
+};
+
+std::vector<BenchmarkResult> RunBenchmark(const int blockSize, const size_t numFrames = 1 << 17)
+{
+  std::vector<BenchmarkResult> results;
+  std::vector<float> input(numFrames);
+  for (size_t i = 0; i < numFrames; i++)
+    input[i] = std::sin(0.01f * i) + 0.5f * std::sin(0.37f * i);
+  std::vector<float> output(numFrames);
+  for (size_t irLength = 512; irLength <= 65536; irLength *= 2)
+  {
+    std::vector<float> ir(irLength);
+    for (size_t i = 0; i < irLength; i++)
+      ir[i] = std::exp(-5.0f * i / irLength) * std::cos(0.3f * i);
+
+    dsp::convolution::UniformConvolver convolver;
+    convolver.SetKernel(std::make_shared<const dsp::convolution::PartitionedKernel>(
+      ir.data(), irLength, dsp::convolution::GetPartitionSize(blockSize)));
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numFrames; i += blockSize)
+    {
+      const size_t n = std::min((size_t)blockSize, numFrames - i);
+      convolver.Process(input.data() + i, output.data() + i, n);
+    }
+    const double partitioned =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numFrames;
+
+    // Direct convolution is slow, so time fewer samples.
+    const size_t numDirect = std::max<size_t>(blockSize, numFrames / (irLength / 256));
+    std::vector<float> history(irLength - 1 + numDirect, 0.0f);
+    std::copy(input.begin(), input.begin() + numDirect, history.begin() + irLength - 1);
+    std::vector<float> reversed(ir.rbegin(), ir.rend());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numDirect; i++)
+    {
+      float acc = 0.0f;
+      const float* x = history.data() + i;
+      for (size_t k = 0; k < irLength; k++)
+        acc += reversed[k] * x[k];
+      output[i] = acc;
+    }
+    const double direct =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numDirect;
+    results.push_back({irLength, partitioned, direct});
+  }
+  return results;
+};
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  const int blockSize = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 256;
+  std::printf("Block size %d (partition size %zu)\n", blockSize, dsp::convolution::GetPartitionSize(blockSize));
+  std::printf("Nanoseconds per sample:\n%8s %12s %12s %9s\n", "IR", "partitioned", "direct", "speedup");
+  for (const auto& result : RunBenchmark(blockSize))
+    std::printf("%8zu %12.2f %12.2f %8.1fx\n", result.irLength, result.partitioned, result.direct,
+                result.direct / result.partitioned);
+  return 0;
+}
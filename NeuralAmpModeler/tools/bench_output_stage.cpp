@@ -0,0 +1,147 @@
+// Times dsp::OutputStage (OutputStage.h) against the passes it replaced: a recursive_linear_filter::HighPass per
+// channel, the output gain (and clamp) into the host's buffers, then the peak of each frame for the output meter.
+// Same settings, stereo noise with some DC. Also checks that they come out the same.
+// Usage: bench_output_stage [block size]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "AudioDSPTools/dsp/RecursiveLinearFilter.h"
+#include "OutputStage.h"
+
+namespace
+{
+const double kSampleRate = 48000.0;
+const double kDCBlockerFrequency = 5.0;
+const double kGain = 0.8;
+// Like the standalone app
+const bool kClamp = true;
+const size_t kNumChannels = dsp::OutputStage::kMaxChannels;
+
+// The output stage before it was fused
+class ScalarOutputStage
+{
+public:
+  ScalarOutputStage(const int maxBlockSize)
+  : mMerged(maxBlockSize)
+  {
+    const recursive_linear_filter::HighPassParams params(kSampleRate, kDCBlockerFrequency);
+    for (auto& highPass : mHighPasses)
+      highPass.SetParams(params);
+  };
+
+  // :return: The peak of the block (what the meter got)
+  double Process(double** inputs, double** outputs, const int numFrames)
+  {
+    for (size_t c = 0; c < kNumChannels; c++)
+    {
+      double** filtered = mHighPasses[c].Process(inputs + c, 1, numFrames);
+      for (int s = 0; s < numFrames; s++)
+      {
+        const double y = kGain * filtered[0][s];
+        outputs[c][s] = kClamp ? std::clamp(y, -1.0, 1.0) : y;
+      }
+    }
+    double peak = 0.0;
+    for (int s = 0; s < numFrames; s++)
+    {
+      mMerged[s] = std::max(std::abs(outputs[0][s]), std::abs(outputs[1][s]));
+      peak = std::max(peak, mMerged[s]);
+    }
+    return peak;
+  };
+
+private:
+  recursive_linear_filter::HighPass mHighPasses[kNumChannels];
+  std::vector<double> mMerged;
+};
+
+class FusedOutputStage
+{
+public:
+  FusedOutputStage()
+  {
+    mOutputStage.SetSampleRate(kSampleRate, kDCBlockerFrequency);
+    mOutputStage.Reset();
+  };
+
+  double Process(double** inputs, double** outputs, const int numFrames)
+  {
+    dsp::OutputStage::Levels levels;
+    mOutputStage.Process(inputs, outputs, kNumChannels, numFrames, kGain, 1.0, kClamp, levels);
+    return std::max(levels.peak[0], levels.peak[1]);
+  };
+
+private:
+  dsp::OutputStage mOutputStage;
+};
+
+// Runs the signal through in blocks and keeps what comes out.
+// :return: Nanoseconds per (stereo) frame
+template <typename OutputStage>
+double Run(OutputStage& outputStage, std::vector<std::vector<double>>& signal, const int blockSize,
+           std::vector<std::vector<double>>& output, double& peak)
+{
+  const int numFrames = (int)signal[0].size();
+  output.assign(kNumChannels, std::vector<double>(numFrames));
+  double* inputs[kNumChannels];
+  double* outputs[kNumChannels];
+  peak = 0.0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numFrames; i += blockSize)
+  {
+    const int n = std::min(blockSize, numFrames - i);
+    for (size_t c = 0; c < kNumChannels; c++)
+    {
+      inputs[c] = signal[c].data() + i;
+      outputs[c] = output[c].data() + i;
+    }
+    peak = std::max(peak, outputStage.Process(inputs, outputs, n));
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numFrames;
+};
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  const int blockSize = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 64;
+  const int numFrames = blockSize * (int)std::ceil(1.0e6 / blockSize);
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  std::vector<std::vector<double>> signal(kNumChannels, std::vector<double>(numFrames));
+  for (auto& channel : signal)
+    for (auto& x : channel)
+      x = 0.2 + noise(rng);
+
+  std::vector<std::vector<double>> fusedOutput, scalarOutput;
+  double fusedPeak = 0.0;
+  double scalarPeak = 0.0;
+  // Once each to warm up, then for real
+  {
+    FusedOutputStage fused;
+    ScalarOutputStage scalar(blockSize);
+    Run(fused, signal, blockSize, fusedOutput, fusedPeak);
+    Run(scalar, signal, blockSize, scalarOutput, scalarPeak);
+  }
+  FusedOutputStage fused;
+  ScalarOutputStage scalar(blockSize);
+  const double fusedTime = Run(fused, signal, blockSize, fusedOutput, fusedPeak);
+  const double scalarTime = Run(scalar, signal, blockSize, scalarOutput, scalarPeak);
+
+  double maxDifference = 0.0;
+  for (size_t c = 0; c < kNumChannels; c++)
+    for (int i = 0; i < numFrames; i++)
+      maxDifference = std::max(maxDifference, std::abs(fusedOutput[c][i] - scalarOutput[c][i]));
+
+  std::printf("%.0f Hz, block size %d, stereo\n", kSampleRate, blockSize);
+  std::printf("Fused:  %7.2f ns per frame\n", fusedTime);
+  std::printf("Scalar: %7.2f ns per frame (%.1fx)\n", scalarTime, scalarTime / fusedTime);
+  std::printf("Max difference %.3g, peaks %.6f and %.6f\n", maxDifference, fusedPeak, scalarPeak);
+  return 0;
+}
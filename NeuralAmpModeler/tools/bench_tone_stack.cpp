@@ -0,0 +1,125 @@
+// Times BasicNamToneStack (one fused biquad cascade; see BiquadCascade.h) against the way it used to run: a
+// recursive_linear_filter per band, one after the other. Same knobs and bands, stereo white noise. Also checks that
+// they come out the same.
+// Usage: bench_tone_stack [block size]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "AudioDSPTools/dsp/RecursiveLinearFilter.h"
+#include "ToneStack.h"
+
+namespace
+{
+const double kSampleRate = 48000.0;
+const double kBass = 8.0;
+const double kMiddle = 2.0;
+const double kTreble = 7.0;
+
+// The tone stack before it was fused, with the same bands
+class PerBandToneStack
+{
+public:
+  PerBandToneStack()
+  {
+    mBass.SetParams(_GetParams(dsp::tone_stack::kParamBass, kBass, 4.0, 1.0));
+    // Narrower when it cuts
+    mMiddle.SetParams(_GetParams(dsp::tone_stack::kParamMiddle, kMiddle, 3.0, kMiddle < 5.0 ? 1.5 / 0.7 : 1.0));
+    mTreble.SetParams(_GetParams(dsp::tone_stack::kParamTreble, kTreble, 2.0, 1.0));
+  };
+
+  DSP_SAMPLE** Process(DSP_SAMPLE** inputs, const int numChannels, const int numFrames)
+  {
+    DSP_SAMPLE** bass = mBass.Process(inputs, numChannels, numFrames);
+    DSP_SAMPLE** middle = mMiddle.Process(bass, numChannels, numFrames);
+    return mTreble.Process(middle, numChannels, numFrames);
+  };
+
+private:
+  static recursive_linear_filter::BiquadParams _GetParams(const dsp::tone_stack::Param param, const double val,
+                                                         const double dbPerStep, const double qualityScale)
+  {
+    const dsp::tone_stack::Band band = dsp::tone_stack::BasicNamToneStack::GetDefaultBand(param);
+    return recursive_linear_filter::BiquadParams(
+      kSampleRate, band.frequency, qualityScale * band.quality, dbPerStep * (val - 5.0));
+  };
+
+  recursive_linear_filter::LowShelf mBass;
+  recursive_linear_filter::Peaking mMiddle;
+  recursive_linear_filter::HighShelf mTreble;
+};
+
+// Runs the signal through in blocks and keeps what comes out.
+// :return: Nanoseconds per (stereo) frame
+template <typename ToneStack>
+double Run(ToneStack& toneStack, std::vector<std::vector<DSP_SAMPLE>>& signal, const int blockSize,
+           std::vector<std::vector<DSP_SAMPLE>>& output)
+{
+  const int numChannels = (int)signal.size();
+  const int numFrames = (int)signal[0].size();
+  output.assign(numChannels, std::vector<DSP_SAMPLE>(numFrames));
+  std::vector<DSP_SAMPLE*> inputs(numChannels);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numFrames; i += blockSize)
+  {
+    const int n = std::min(blockSize, numFrames - i);
+    for (int c = 0; c < numChannels; c++)
+      inputs[c] = signal[c].data() + i;
+    DSP_SAMPLE** outputs = toneStack.Process(inputs.data(), numChannels, n);
+    for (int c = 0; c < numChannels; c++)
+      std::copy(outputs[c], outputs[c] + n, output[c].begin() + i);
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numFrames;
+};
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  const int blockSize = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 64;
+  const int numFrames = blockSize * (int)std::ceil(1.0e6 / blockSize);
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  std::vector<std::vector<DSP_SAMPLE>> signal(2, std::vector<DSP_SAMPLE>(numFrames));
+  for (auto& channel : signal)
+    for (auto& x : channel)
+      x = noise(rng);
+
+  dsp::tone_stack::BasicNamToneStack fused;
+  fused.Reset(kSampleRate, blockSize);
+  fused.Prepare(kSampleRate);
+  fused.SetParam(dsp::tone_stack::kParamBass, kBass);
+  fused.SetParam(dsp::tone_stack::kParamMiddle, kMiddle);
+  fused.SetParam(dsp::tone_stack::kParamTreble, kTreble);
+  PerBandToneStack perBand;
+
+  std::vector<std::vector<DSP_SAMPLE>> fusedOutput, perBandOutput;
+  // Once each to warm up, then for real
+  Run(fused, signal, blockSize, fusedOutput);
+  Run(perBand, signal, blockSize, perBandOutput);
+  fused.Reset(kSampleRate, blockSize);
+  perBand = PerBandToneStack();
+  const double fusedTime = Run(fused, signal, blockSize, fusedOutput);
+  const double perBandTime = Run(perBand, signal, blockSize, perBandOutput);
+
+  double maxDifference = 0.0;
+  double peak = 0.0;
+  for (size_t c = 0; c < signal.size(); c++)
+    for (int i = 0; i < numFrames; i++)
+    {
+      maxDifference = std::max(maxDifference, std::abs(fusedOutput[c][i] - perBandOutput[c][i]));
+      peak = std::max(peak, std::abs(perBandOutput[c][i]));
+    }
+
+  std::printf("%.0f Hz, block size %d, bass %.0f / middle %.0f / treble %.0f, stereo\n", kSampleRate, blockSize,
+              kBass, kMiddle, kTreble);
+  std::printf("Fused cascade: %7.2f ns per frame\n", fusedTime);
+  std::printf("Per band:      %7.2f ns per frame (%.1fx)\n", perBandTime, perBandTime / fusedTime);
+  std::printf("Max difference %.3g (peak %.3g)\n", maxDifference, peak);
+  return 0;
+}